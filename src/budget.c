@@ -0,0 +1,337 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+#include "process_iterator.h"
+#include "process_group.h"
+#include "list.h"
+
+#ifndef EPSILON
+#define EPSILON 1e-12
+#endif
+
+static struct budget_node *new_budget_node(pid_t pid, double limit, struct budget_node *parent)
+{
+	struct budget_node *node = (struct budget_node *)malloc(sizeof(struct budget_node));
+	if (node == NULL)
+	{
+		exit(-1);
+	}
+	node->members = (struct list *)malloc(sizeof(struct list));
+	if (node->members == NULL)
+	{
+		exit(-1);
+	}
+	init_list(node->members, sizeof(pid_t));
+	node->pid = pid;
+	node->limit = limit;
+	node->parent = parent;
+	node->usage = node->sample = -1;
+	node->demand = 0;
+	node->budget = node->share = limit;
+	node->workingrate = -1;
+	return node;
+}
+
+int init_budget_tree(struct budget_tree *tree, double limit)
+{
+	tree->nodes = (struct list *)malloc(sizeof(struct list));
+	if (tree->nodes == NULL)
+	{
+		exit(-1);
+	}
+	init_list(tree->nodes, sizeof(pid_t));
+	add_elem(tree->nodes, new_budget_node(0, limit, NULL));
+	return 0;
+}
+
+struct budget_node *budget_root(struct budget_tree *tree)
+{
+	return (struct budget_node *)first_elem(tree->nodes);
+}
+
+/* add a node owning the subtree of pid
+the node is attached below the deepest node owning an ancestor of pid
+return:  0 if the node was added
+		 1 if pid already owns a node */
+int add_budget_node(struct budget_tree *tree, pid_t pid, double limit)
+{
+	struct budget_node *parent = budget_root(tree);
+	struct budget_node *node;
+	struct list_node *n;
+	if (pid <= 0 || locate_elem(tree->nodes, &pid) != NULL)
+		return 1;
+	for (n = tree->nodes->first->next; n != NULL; n = n->next)
+	{
+		struct budget_node *other = (struct budget_node *)n->data;
+		if (is_child_of(pid, other->pid) &&
+			(parent->parent == NULL || is_child_of(other->pid, parent->pid)))
+			parent = other;
+	}
+	node = new_budget_node(pid, limit, parent);
+	/* nodes added earlier may belong to the subtree of the new one */
+	for (n = tree->nodes->first->next; n != NULL; n = n->next)
+	{
+		struct budget_node *other = (struct budget_node *)n->data;
+		if (other->parent == parent && is_child_of(other->pid, pid))
+			other->parent = node;
+	}
+	add_elem(tree->nodes, node);
+	return 0;
+}
+
+/* remove the node owned by pid, its children are attached to its parent
+return:  0 if the node was removed
+		 1 if pid does not own a node */
+int remove_budget_node(struct budget_tree *tree, pid_t pid)
+{
+	struct list_node *node;
+	struct list_node *n;
+	struct budget_node *removed;
+	if (pid <= 0 || (node = locate_node(tree->nodes, &pid)) == NULL)
+		return 1;
+	removed = (struct budget_node *)node->data;
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *other = (struct budget_node *)n->data;
+		if (other->parent == removed)
+			other->parent = removed->parent;
+	}
+	clear_list(removed->members);
+	free(removed->members);
+	destroy_node(tree->nodes, node);
+	return 0;
+}
+
+/* the node owning a process is the one of its nearest ancestor owning a node */
+static struct budget_node *find_owner(struct budget_tree *tree, struct process_group *pgroup,
+									  const struct process *p)
+{
+	int hops;
+	for (hops = 0; p != NULL && hops <= pgroup->proclist->count; hops++)
+	{
+		struct budget_node *node = (struct budget_node *)locate_elem(tree->nodes, &p->pid);
+		if (node != NULL)
+			return node;
+		p = locate_process(pgroup, p->ppid);
+	}
+	return budget_root(tree);
+}
+
+static double member_demand(const struct budget_node *node)
+{
+	if (node->members->count == 0)
+		return 0;
+	if (node->usage < 0 || node->workingrate < 0)
+		return node->limit;
+	/* running during a fraction workingrate of the time, the members used usage */
+	return MIN(node->usage / MAX(node->workingrate, EPSILON), node->limit);
+}
+
+static double compute_demand(struct budget_tree *tree, struct budget_node *node)
+{
+	struct list_node *n;
+	double demand = member_demand(node);
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *child = (struct budget_node *)n->data;
+		if (child->parent == node)
+			demand += compute_demand(tree, child);
+	}
+	node->demand = MIN(demand, node->limit);
+	return node->demand;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* max-min fair level: everybody wanting less than it gets what it wants,
+the others get the level itself and the whole budget is used */
+static double fair_level(double *want, int count, double budget)
+{
+	int i;
+	qsort(want, count, sizeof(double), compare_double);
+	for (i = 0; i < count; i++)
+	{
+		double level = budget / (count - i);
+		if (want[i] > level)
+			return level;
+		budget -= want[i];
+	}
+	/* there is enough for everybody */
+	return -1;
+}
+
+/* share the budget of a node between its members and its children
+the shares always add up to the budget, so that the limit of the node
+holds even when they all use their shares at once: each gets what it
+wants up to the fair level, and what nobody wants is split evenly */
+static void allocate_budget(struct budget_tree *tree, struct budget_node *node, double budget)
+{
+	struct list_node *n;
+	double *want;
+	double level, spare = 0;
+	int count = 1, i;
+
+	node->budget = MIN(budget, node->limit);
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		if (((struct budget_node *)n->data)->parent == node)
+			count++;
+	}
+	want = (double *)malloc(count * sizeof(double));
+	if (want == NULL)
+	{
+		exit(-1);
+	}
+	/* the members of the node compete with the subtrees of the children */
+	want[0] = member_demand(node);
+	count = 1;
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *child = (struct budget_node *)n->data;
+		if (child->parent == node)
+			want[count++] = child->demand;
+	}
+	level = fair_level(want, count, node->budget);
+	if (level < 0)
+	{
+		/* there is enough for everybody */
+		level = node->budget;
+		spare = node->budget;
+		for (i = 0; i < count; i++)
+			spare -= want[i];
+		/* nothing for the members if there are none */
+		spare = MAX(spare, 0) / MAX(count - (node->members->count == 0), 1);
+	}
+	free(want);
+
+	node->share = MIN(member_demand(node), level) + spare;
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *child = (struct budget_node *)n->data;
+		if (child->parent == node)
+			allocate_budget(tree, child, MIN(child->demand, level) + spare);
+	}
+}
+
+/* split the processes of the group among the nodes, then share the
+budget of the root between the nodes and adjust their working rates */
+void update_budget_tree(struct budget_tree *tree, struct process_group *pgroup)
+{
+	struct list_node *n;
+
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *node = (struct budget_node *)n->data;
+		clear_list(node->members);
+		node->usage = node->sample = -1;
+	}
+	for (n = pgroup->proclist->first; n != NULL; n = n->next)
+	{
+		struct process *p = (struct process *)n->data;
+		struct budget_node *node = find_owner(tree, pgroup, p);
+		add_elem(node->members, p);
+		if (p->used >= 0 && pgroup->sample_interval > 0)
+			node->sample = MAX(node->sample, 0) + p->used / pgroup->sample_interval;
+		if (p->cpu_usage < 0)
+			continue;
+		if (node->usage < 0)
+			node->usage = 0;
+		node->usage += p->cpu_usage;
+	}
+
+	compute_demand(tree, budget_root(tree));
+	allocate_budget(tree, budget_root(tree), budget_root(tree)->limit);
+
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *node = (struct budget_node *)n->data;
+		if (node->members->count == 0)
+			continue;
+		if (node->usage < 0 || node->workingrate < 0)
+		{
+			/* first cycle, initialize workingrate */
+			node->workingrate = node->share;
+		}
+		else if (node->sample > node->share * STEP_RATIO +
+				 node->members->count * CPUTIME_RESOLUTION / pgroup->sample_interval)
+		{
+			/* the members stepped up, the usage lags behind: the working
+			rate is corrected at once, and the usage expected with it */
+			double ratio = node->share / node->sample;
+			struct list_node *m;
+			node->workingrate *= ratio;
+			for (m = node->members->first; m != NULL; m = m->next)
+			{
+				struct process *p = (struct process *)m->data;
+				if (p->used >= 0)
+					p->cpu_usage = p->used / pgroup->sample_interval * ratio;
+			}
+		}
+		else
+		{
+			/* adjust workingrate */
+			node->workingrate = node->workingrate * node->share / MAX(node->usage, EPSILON);
+		}
+		node->workingrate = MAX(MIN(node->workingrate, 1 - EPSILON), EPSILON);
+	}
+}
+
+/* check whether the limits can be left unenforced, after an update
+ratio: fraction of its limit the demand of every node must stay under
+return:  1 if no node demands ratio times its limit or more, 0 otherwise */
+int under_budget_limits(struct budget_tree *tree, double ratio)
+{
+	struct list_node *n;
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		const struct budget_node *node = (const struct budget_node *)n->data;
+		if (node->demand >= node->limit * ratio)
+			return 0;
+	}
+	return 1;
+}
+
+int close_budget_tree(struct budget_tree *tree)
+{
+	struct list_node *n;
+	for (n = tree->nodes->first; n != NULL; n = n->next)
+	{
+		struct budget_node *node = (struct budget_node *)n->data;
+		clear_list(node->members);
+		free(node->members);
+	}
+	destroy_list(tree->nodes);
+	free(tree->nodes);
+	tree->nodes = NULL;
+	return 0;
+}
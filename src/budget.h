@@ -0,0 +1,83 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUDGET_H
+#define __BUDGET_H
+
+#include <sys/types.h>
+
+#include "process_group.h"
+#include "list.h"
+
+/* the members of a node stepped up when the last sample exceeds its share
+this many times, beyond the resolution of the cpu times */
+#define STEP_RATIO 1.5
+/* resolution of the cpu times of the samples (in ms), USER_HZ=100 */
+#define CPUTIME_RESOLUTION 10
+
+/* node of the budget tree
+the root node owns the whole process group, every other node owns the
+subtree of its pid and draws its cpu from the budget of its parent */
+struct budget_node
+{
+	/* pid owning the node, 0 for the root */
+	pid_t pid;
+	/* maximum cpu usage of the node and its descendants (range 0-NCPU) */
+	double limit;
+	/* parent node, NULL for the root */
+	struct budget_node *parent;
+	/* processes of the node not belonging to any descendant node */
+	struct list *members;
+	/* cpu usage of the members (range 0-NCPU), -1 if unknown */
+	double usage;
+	/* cpu usage of the members in the last sample alone, -1 if unknown */
+	double sample;
+	/* cpu usage the node and its descendants would have without limits */
+	double demand;
+	/* cpu granted to the node and its descendants in this cycle */
+	double budget;
+	/* cpu granted to the members in this cycle */
+	double share;
+	/* rate at which the members are kept active (range 0-1) */
+	double workingrate;
+};
+
+struct budget_tree
+{
+	/* all the nodes, the root first */
+	struct list *nodes;
+};
+
+int init_budget_tree(struct budget_tree *tree, double limit);
+
+int add_budget_node(struct budget_tree *tree, pid_t pid, double limit);
+
+int remove_budget_node(struct budget_tree *tree, pid_t pid);
+
+struct budget_node *budget_root(struct budget_tree *tree);
+
+void update_budget_tree(struct budget_tree *tree, struct process_group *pgroup);
+
+int under_budget_limits(struct budget_tree *tree, double ratio);
+
+int close_budget_tree(struct budget_tree *tree);
+
+#endif
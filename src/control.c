@@ -0,0 +1,286 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+static int set_nonblock_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+	return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* create the listening socket at path
+only the owner of cpulimit is allowed to connect to it
+return:  0 on success, -1 on error (errno is set) */
+int open_control_socket(struct control_socket *cs, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	mode_t old_umask;
+	int i, ret;
+
+	cs->fd = -1;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+		cs->clients[i].fd = -1;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* remove the socket left by a previous instance */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	if ((cs->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	old_umask = umask(0077);
+	ret = bind(cs->fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_umask);
+	if (ret < 0 || listen(cs->fd, CONTROL_MAX_CLIENTS) < 0 ||
+		set_nonblock_cloexec(cs->fd) < 0)
+	{
+		int err = errno;
+		close(cs->fd);
+		cs->fd = -1;
+		errno = err;
+		return -1;
+	}
+	strcpy(cs->path, path);
+	cs->owner = getpid();
+	return 0;
+}
+
+static void close_client(struct control_client *client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+}
+
+static void accept_clients(struct control_socket *cs)
+{
+	int fd;
+	while ((fd = accept(cs->fd, NULL, NULL)) >= 0)
+	{
+		int i;
+		for (i = 0; i < CONTROL_MAX_CLIENTS && cs->clients[i].fd >= 0; i++)
+			;
+		if (i == CONTROL_MAX_CLIENTS || set_nonblock_cloexec(fd) < 0)
+		{
+			/* too many clients */
+			close(fd);
+			continue;
+		}
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+		{
+			int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+		}
+#endif
+		cs->clients[i].fd = fd;
+		cs->clients[i].len = 0;
+	}
+}
+
+static void send_reply(struct control_client *client, const char *msg)
+{
+	size_t len = strlen(msg);
+	while (len > 0)
+	{
+		ssize_t n;
+#ifdef MSG_NOSIGNAL
+		n = send(client->fd, msg, len, MSG_NOSIGNAL);
+#else
+		n = send(client->fd, msg, len, 0);
+#endif
+		if (n <= 0)
+		{
+			/* the client is gone or too slow to read its replies */
+			if (n < 0 && errno == EINTR)
+				continue;
+			close_client(client);
+			return;
+		}
+		msg += n;
+		len -= n;
+	}
+}
+
+static int parse_number(const char *str, long *value)
+{
+	char *end;
+	errno = 0;
+	*value = strtol(str, &end, 10);
+	if (errno != 0 || end == str)
+		return -1;
+	while (*end == ' ' || *end == '\t' || *end == '\r')
+		end++;
+	return *end == '\0' ? 0 : -1;
+}
+
+/* parse a command line, replying on errors
+return:  0 if cmd is valid, -1 otherwise */
+static int parse_command(struct control_client *client, char *line, struct control_command *cmd)
+{
+	static const struct
+	{
+		const char *name;
+		enum control_command_type type;
+		int has_arg;
+	} commands[] = {
+		{"set-limit", CONTROL_SET_LIMIT, 1},
+		{"add-target", CONTROL_ADD_TARGET, 1},
+		{"remove-target", CONTROL_REMOVE_TARGET, 1},
+		{"set-children", CONTROL_SET_CHILDREN, 1},
+		{"pause", CONTROL_PAUSE, 0},
+		{"resume", CONTROL_RESUME, 0},
+		{"stats", CONTROL_STATS, 0}};
+	size_t i, name_len;
+	char *arg;
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+	name_len = strcspn(line, " \t\r");
+	arg = line + name_len;
+	while (*arg == ' ' || *arg == '\t' || *arg == '\r')
+		arg++;
+	if (name_len == 0)
+		return -1;
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+	{
+		if (strlen(commands[i].name) != name_len ||
+			strncmp(commands[i].name, line, name_len) != 0)
+			continue;
+		cmd->type = commands[i].type;
+		cmd->value = 0;
+		if (commands[i].has_arg ? parse_number(arg, &cmd->value) != 0 : *arg != '\0')
+		{
+			send_reply(client, commands[i].has_arg ? "error: invalid argument\n" : "error: unexpected argument\n");
+			return -1;
+		}
+		return 0;
+	}
+	send_reply(client, "error: unknown command\n");
+	return -1;
+}
+
+/* get the next pending command, without blocking
+return:  1 if a command was stored in cmd
+		 0 if there are no more commands */
+int read_control_command(struct control_socket *cs, struct control_command *cmd)
+{
+	int i;
+	if (cs->fd < 0)
+		return 0;
+	accept_clients(cs);
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+	{
+		struct control_client *client = &cs->clients[i];
+		while (client->fd >= 0)
+		{
+			char *newline = (char *)memchr(client->buf, '\n', client->len);
+			if (newline != NULL)
+			{
+				int ret;
+				int line_len = newline - client->buf + 1;
+				*newline = '\0';
+				ret = parse_command(client, client->buf, cmd);
+				memmove(client->buf, client->buf + line_len, client->len - line_len);
+				client->len -= line_len;
+				if (ret == 0)
+				{
+					cmd->client = i;
+					return 1;
+				}
+			}
+			else if (client->len == (int)sizeof(client->buf))
+			{
+				send_reply(client, "error: line too long\n");
+				if (client->fd >= 0)
+					close_client(client);
+			}
+			else
+			{
+				ssize_t n = read(client->fd, client->buf + client->len, sizeof(client->buf) - client->len);
+				if (n > 0)
+					client->len += n;
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					close_client(client);
+				else
+					break;
+			}
+		}
+	}
+	return 0;
+}
+
+/* send a reply to the client which sent cmd */
+void reply_control_command(struct control_socket *cs, const struct control_command *cmd, const char *fmt, ...)
+{
+	char msg[1024];
+	va_list args;
+	struct control_client *client = &cs->clients[cmd->client];
+	if (client->fd < 0)
+		return;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	send_reply(client, msg);
+}
+
+void close_control_socket(struct control_socket *cs)
+{
+	int i;
+	if (cs->fd < 0)
+		return;
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+	{
+		if (cs->clients[i].fd >= 0)
+			close_client(&cs->clients[i]);
+	}
+	close(cs->fd);
+	cs->fd = -1;
+	/* forked children must not remove the socket of their parent */
+	if (cs->owner == getpid())
+		unlink(cs->path);
+}
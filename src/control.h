@@ -0,0 +1,89 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include <sys/types.h>
+#include <sys/un.h>
+
+/* maximum number of clients connected at the same time */
+#define CONTROL_MAX_CLIENTS 8
+/* maximum length of a command line, including the newline */
+#define CONTROL_LINE_MAX 256
+
+/* commands of the line protocol, one per line:
+	set-limit N        percentage of cpu allowed
+	add-target PID     limit also PID (and its children, with -i)
+	remove-target PID  stop limiting PID
+	set-children 0|1   change the include-children setting
+	pause              stop enforcing the limit
+	resume             enforce the limit again
+	stats              dump the control statistics
+every reply ends with a line "ok" or "error: <reason>" */
+enum control_command_type
+{
+	CONTROL_SET_LIMIT,
+	CONTROL_ADD_TARGET,
+	CONTROL_REMOVE_TARGET,
+	CONTROL_SET_CHILDREN,
+	CONTROL_PAUSE,
+	CONTROL_RESUME,
+	CONTROL_STATS
+};
+
+struct control_command
+{
+	enum control_command_type type;
+	/* argument of the command, if any */
+	long value;
+	/* index of the client that sent the command */
+	int client;
+};
+
+struct control_client
+{
+	/* connected socket, -1 if the slot is free */
+	int fd;
+	/* partial line received so far */
+	char buf[CONTROL_LINE_MAX];
+	int len;
+};
+
+struct control_socket
+{
+	/* listening socket, -1 if closed */
+	int fd;
+	/* pid of the process that created the socket file */
+	pid_t owner;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	struct control_client clients[CONTROL_MAX_CLIENTS];
+};
+
+int open_control_socket(struct control_socket *cs, const char *path);
+
+int read_control_command(struct control_socket *cs, struct control_command *cmd);
+
+void reply_control_command(struct control_socket *cs, const struct control_command *cmd, const char *fmt, ...);
+
+void close_control_socket(struct control_socket *cs);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+
+#include "controller.h"
+#include "budget.h"
+#include "list.h"
+
+static int compare_workingrate(const void *a, const void *b)
+{
+	double x = (*(struct budget_node *const *)a)->workingrate;
+	double y = (*(struct budget_node *const *)b)->workingrate;
+	return (x > y) - (x < y);
+}
+
+/* run the processes for one slot, according to the working rates of the tree
+everybody is resumed, the nodes are stopped in order of working slice,
+then everybody sleeps until the end of the slot */
+void run_control_slot(struct budget_tree *tree, const struct limiter_clock *clock,
+					  const struct limiter_actuator *actuator)
+{
+	struct budget_node **groups;
+	struct list_node *node;
+	double elapsed_nsec = 0;
+	struct timespec start;
+	int i, count = 0;
+
+	actuator->resume(actuator->data);
+	clock->now(clock->data, &start);
+
+	groups = (struct budget_node **)malloc(tree->nodes->count * sizeof(struct budget_node *));
+	if (groups == NULL)
+	{
+		exit(-1);
+	}
+	for (node = tree->nodes->first; node != NULL; node = node->next)
+	{
+		struct budget_node *group = (struct budget_node *)node->data;
+		if (group->members->count > 0)
+			groups[count++] = group;
+	}
+	qsort(groups, count, sizeof(struct budget_node *), compare_workingrate);
+
+	for (i = 0; i < count; i++)
+	{
+		double twork_total_nsec = (double)TIME_SLOT * 1000 * groups[i]->workingrate;
+		if (twork_total_nsec > elapsed_nsec)
+		{
+			clock->sleep_until(clock->data, &start, twork_total_nsec);
+			elapsed_nsec = twork_total_nsec;
+		}
+		/* stop processes only if tsleep>0 */
+		if ((double)TIME_SLOT * 1000 - twork_total_nsec >= 1)
+			actuator->stop(actuator->data, groups[i]);
+	}
+	free(groups);
+
+	/* now the processes are sleeping */
+	if ((double)TIME_SLOT * 1000 - elapsed_nsec >= 1)
+		clock->sleep_until(clock->data, &start, (double)TIME_SLOT * 1000);
+}
+
+void init_limiter_modes(struct limiter_modes *modes, double burst, double hard_limit)
+{
+	modes->burst = burst;
+	modes->hard_limit = hard_limit;
+	modes->credit = 0;
+	modes->bursting = 0;
+	modes->enforcing = 1;
+	modes->free_run = 0;
+	modes->under_slots = 0;
+}
+
+/* token bucket of the burst mode
+the cpu left unused below the limit is saved as credit, up to burst
+seconds at the limit, and the processes run at full speed while it lasts
+return:  1 if the processes can run at full speed, 0 otherwise */
+static int update_burst_credit(struct limiter_modes *modes, double limit,
+							   const struct process_group *pgroup)
+{
+	double max_credit = limit * modes->burst * 1000;
+	modes->credit += limit * pgroup->sample_interval - pgroup->sample_cputime;
+	modes->credit = MAX(MIN(modes->credit, max_credit), 0);
+	if (modes->credit <= 0)
+		return 0;
+	/* do not start a burst for less than a slot at the limit */
+	return modes->bursting || modes->credit >= limit * TIME_SLOT / 1000;
+}
+
+/* update the burst credit and the cpu pressure with the last sample
+limit: the limit of the group, ncpu: the number of cpus
+pressure: checked in work-conserving mode only
+return:  the limit of the group for the next slot */
+double update_limiter_modes(struct limiter_modes *modes, double limit, int ncpu,
+							const struct process_group *pgroup,
+							const struct limiter_pressure *pressure)
+{
+	if (modes->burst > 0)
+		modes->bursting = update_burst_credit(modes, limit, pgroup);
+	if (modes->hard_limit >= 0)
+	{
+		double own = 0;
+		if (pgroup->sample_interval > 0)
+			own = pgroup->sample_cputime / (pgroup->sample_interval * ncpu);
+		modes->enforcing = pressure->enforce(pressure->data, own);
+	}
+	if (modes->bursting)
+		return ncpu;
+	if (!modes->enforcing)
+		return MAX(modes->hard_limit, limit);
+	return limit;
+}
+
+/* check whether the members can run freely in the next slot, the
+usage of the last sample is used to enforce the limit again at once
+the limits of the tree must be up to date
+return:  1 if the members can run freely, 0 otherwise */
+int update_free_run(struct limiter_modes *modes, struct budget_tree *tree,
+					const struct process_group *pgroup)
+{
+	double ratio = modes->free_run ? FREE_RUN_LEAVE : FREE_RUN_ENTER;
+	double usage;
+	/* too close to the last sample */
+	if (pgroup->sample_interval <= 0)
+		return modes->free_run;
+	usage = pgroup->sample_cputime / pgroup->sample_interval;
+	if (usage >= budget_root(tree)->limit * ratio || !under_budget_limits(tree, ratio))
+	{
+		modes->under_slots = 0;
+		modes->free_run = 0;
+	}
+	else if (!modes->free_run && ++modes->under_slots >= FREE_RUN_SLOTS)
+		modes->free_run = 1;
+	return modes->free_run;
+}
@@ -0,0 +1,101 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __CONTROLLER_H
+#define __CONTROLLER_H
+
+#include <time.h>
+
+#include "budget.h"
+#include "process_group.h"
+
+/* control time slot in microseconds */
+/* each slot is splitted in a working slice and a sleeping slice */
+/* TODO: make it adaptive, based on the actual system load */
+#define TIME_SLOT 100000
+
+/* time source of the control loop, the system clock or a simulated one */
+struct limiter_clock
+{
+	void *data;
+	/* current time */
+	void (*now)(void *data, struct timespec *t);
+	/* wait until offset_nsec after start */
+	void (*sleep_until)(void *data, const struct timespec *start, double offset_nsec);
+};
+
+/* what the control loop acts upon, the real processes or simulated ones */
+struct limiter_actuator
+{
+	void *data;
+	/* let all the members run */
+	void (*resume)(void *data);
+	/* stop the members of a node of the budget tree */
+	void (*stop)(void *data, struct budget_node *node);
+};
+
+/* what tells whether the system is short of cpu, measured or simulated */
+struct limiter_pressure
+{
+	void *data;
+	/* 1 if the limit must be enforced
+	own: share of all the cpus used by the group (range 0-1) */
+	int (*enforce)(void *data, double own);
+};
+
+/* slots in a row the usage must stay under the limit before the
+members run freely, without being signalled */
+#define FREE_RUN_SLOTS 5
+/* fraction of the limit the usage must stay under to start running freely */
+#define FREE_RUN_ENTER 0.8
+/* fraction of the limit above which the limit is enforced again */
+#define FREE_RUN_LEAVE 0.95
+
+/* the modes of the limiter on top of the limit, kept from slot to slot */
+struct limiter_modes
+{
+	/* seconds of unused limit saved for bursts (0 if disabled) */
+	double burst;
+	/* work-conserving mode: cpu allowed while there is no cpu pressure (-1 if disabled) */
+	double hard_limit;
+	/* cpu time (in ms) saved for bursts */
+	double credit;
+	int bursting;
+	/* the limit is enforced (always, unless in work-conserving mode) */
+	int enforcing;
+	/* the usage is under the limit, the members are not signalled */
+	int free_run;
+	int under_slots;
+};
+
+void run_control_slot(struct budget_tree *tree, const struct limiter_clock *clock,
+					  const struct limiter_actuator *actuator);
+
+void init_limiter_modes(struct limiter_modes *modes, double burst, double hard_limit);
+
+double update_limiter_modes(struct limiter_modes *modes, double limit, int ncpu,
+							const struct process_group *pgroup,
+							const struct limiter_pressure *pressure);
+
+int update_free_run(struct limiter_modes *modes, struct budget_tree *tree,
+					const struct process_group *pgroup);
+
+#endif
@@ -37,12 +37,29 @@
 #include <time.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/select.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include "process_group.h"
 #include "list.h"
+#include "control.h"
+#include "budget.h"
+#include "pressure.h"
+#include "metrics.h"
+#include "trace.h"
+#include "histogram.h"
+#include "controller.h"
+#include "exec_watch.h"
+#include "rules.h"
+#include "util.h"
 
 /* some useful macro */
 #ifndef MIN
@@ -61,34 +78,10 @@ static char *__basename(char *path)
 #define basename(path) __basename(path)
 #endif
 
-/* inline void nsec2timespec(double nsec, struct timespec *t); */
-#ifndef nsec2timespec
-#define nsec2timespec(nsec, t)                             \
-	do                                                     \
-	{                                                      \
-		(t)->tv_sec = (time_t)((nsec) / 1e9);              \
-		(t)->tv_nsec = (long)((nsec) - (t)->tv_sec * 1e9); \
-	} while (0)
-#endif
-
-/* inline int sleep_timespec(struct timespec *t); */
-#ifndef sleep_timespec
-#if defined(__linux__) && _POSIX_C_SOURCE >= 200112L && defined(CLOCK_TAI)
-#define sleep_timespec(t) clock_nanosleep(CLOCK_TAI, 0, (t), NULL)
-#else
-#define sleep_timespec(t) nanosleep((t), NULL)
-#endif
-#endif
-
 #ifndef EPSILON
 #define EPSILON 1e-12
 #endif
 
-/* control time slot in microseconds */
-/* each slot is splitted in a working slice and a sleeping slice */
-/* TODO: make it adaptive, based on the actual system load */
-#define TIME_SLOT 100000
-
 #define MAX_PRIORITY -20
 
 /* GLOBAL VARIABLES */
@@ -103,30 +96,127 @@ char *program_name;
 /* number of cpu */
 int NCPU;
 
+/* runtime control socket */
+struct control_socket control;
+
+/* the nested groups sharing the limit */
+struct budget_tree budget;
+
+/* cpu pressure of the system, for the work-conserving mode */
+struct cpu_pressure pressure;
+
+/* statistics for other programs */
+struct metrics metrics;
+/* binary trace of the control loop */
+struct trace trace;
+
 /* CONFIGURATION VARIABLES */
 
 /* verbose mode */
 int verbose = 0;
 /* lazy mode (exits if there is no process) */
 int lazy = 0;
+/* path of the control socket (NULL if disabled) */
+char *control_path = NULL;
+/* seconds of unused limit saved for bursts (0 if disabled) */
+double burst = 0;
+/* work-conserving mode: cpu allowed while there is no cpu pressure (-1 if disabled) */
+double hard_limit = -1;
+/* real-time priority of the limiter (0 if disabled) */
+int rt_priority = 0;
+/* cpu the limiter is pinned to (-1 if disabled) */
+int affinity_cpu = -1;
+/* metrics output, FORMAT:PATH (NULL if disabled) */
+char *metrics_spec = NULL;
+/* cycles between two metrics records */
+int metrics_interval = 10;
+/* trace output (NULL if disabled) */
+char *trace_path = NULL;
+/* program whose running instances are all limited together (NULL if only one is) */
+char *target_name = NULL;
+/* rules file of the daemon mode (NULL if disabled) */
+char *rules_path = NULL;
+
+/* patterns of the processes limited in daemon mode */
+struct rule_set rules;
+/* executions of new processes, in daemon mode */
+struct exec_watch rule_watch;
+
+/* nested groups given on the command line */
+struct subgroup
+{
+	pid_t pid;
+	double limit;
+};
+struct subgroup *subgroups = NULL;
+int subgroup_count = 0;
 
-/* quit flag for SIGINT and SIGTERM signals */
+/* how late the limiter woke up from its sleeps, reset at every report */
+struct wakeup_stats
+{
+	/* number of sleeps */
+	int count;
+	/* total and longest delay (in us) */
+	double total;
+	double max;
+};
+struct wakeup_stats wakeup = {0, 0, 0};
+
+/* costs and accuracy of the control loop, printed on SIGUSR1 */
+struct histogram scan_hist;
+struct histogram signal_hist;
+struct histogram wakeup_hist;
+struct histogram error_hist;
+
+/* SIGUSR1 received, the statistics must be printed */
+volatile sig_atomic_t report_flag = 0;
+/* the command run by cpulimit (0 if none), and its wait status once reaped */
+pid_t command_pid = 0;
+int command_done = 0;
+int command_status = -1;
+/* write end of the pipe holding the command before its exec, closed by
+the limiter once the first slice is computed (-1 if none) */
+int gate_fd = -1;
+/* cpulimit adopting the orphans of the command (0 if it does not) */
+pid_t reaper_pid = 0;
+/* children forked by the members were stopped in the last slot */
+int forks_seen = 0;
+
+/* quit flag for SIGINT and SIGTERM signals, the signal received */
 volatile sig_atomic_t quit_flag = 0;
+/* 1 if the quit signal was sent to cpulimit alone, 0 if the terminal sent
+it to the whole process group */
+volatile sig_atomic_t quit_alone = 0;
+/* SIGCHLD received, some child must be reaped */
+volatile sig_atomic_t child_flag = 0;
+/* signal mask of the sleeps, SIGCHLD is blocked but while sleeping */
+sigset_t sleep_mask;
 
-/* SIGINT and SIGTERM signal handler */
+/* SIGUSR1 and SIGCHLD signal handler */
 static void sig_handler(int sig)
 {
 	switch (sig)
 	{
-	case SIGINT:
-	case SIGTERM:
-		quit_flag = 1;
+	case SIGUSR1:
+		report_flag = 1;
+		break;
+	case SIGCHLD:
+		child_flag = 1;
 		break;
 	default:
 		break;
 	}
 }
 
+/* SIGINT and SIGTERM signal handler, tells who sent them */
+static void quit_sig_handler(int sig, siginfo_t *info, void *context)
+{
+	(void)context;
+	quit_flag = sig;
+	/* kill() and sigqueue() give SI_USER and below, the kernel above */
+	quit_alone = info == NULL || info->si_code <= 0;
+}
+
 static void print_usage(FILE *stream, int exit_code)
 {
 	fprintf(stream, "Usage: %s [OPTIONS...] TARGET\n", program_name);
@@ -135,10 +225,30 @@ static void print_usage(FILE *stream, int exit_code)
 	fprintf(stream, "      -v, --verbose          show control statistics\n");
 	fprintf(stream, "      -z, --lazy             exit if there is no target process, or if it dies\n");
 	fprintf(stream, "      -i, --include-children limit also the children processes\n");
+	fprintf(stream, "      -b, --burst=SECONDS    save up to SECONDS of unused limit and spend it\n");
+	fprintf(stream, "                             running at full speed\n");
+	fprintf(stream, "      -w, --work-conserving=N  enforce the limit only under cpu pressure,\n");
+	fprintf(stream, "                             allowing up to N%% of cpu otherwise\n");
+	fprintf(stream, "      -g, --group=PID:N      limit PID (and its children) to N%% of cpu, never\n");
+	fprintf(stream, "                             more than its parent group, may be repeated\n");
+	fprintf(stream, "      -c, --control=PATH     accept runtime commands on the unix socket PATH\n");
+	fprintf(stream, "      -r, --realtime=PRIO    run the limiter with real-time priority PRIO\n");
+	fprintf(stream, "                             and its memory locked\n");
+	fprintf(stream, "      -a, --affinity=CPU     run the limiter on the cpu number CPU only\n");
+	fprintf(stream, "      -m, --metrics=FORMAT:PATH  write statistics to PATH, FORMAT is json\n");
+	fprintf(stream, "                             (lines appended, - for stdout) or prometheus\n");
+	fprintf(stream, "                             (textfile replaced at every record)\n");
+	fprintf(stream, "          --metrics-interval=N  write the statistics every N cycles (default 10)\n");
+	fprintf(stream, "      -t, --trace=FILE       record the samples and the decisions of every cycle\n");
+	fprintf(stream, "                             in FILE, for offline replays\n");
 	fprintf(stream, "      -h, --help             display this help and exit\n");
 	fprintf(stream, "   TARGET must be exactly one of these:\n");
 	fprintf(stream, "      -p, --pid=N            pid of the process (implies -z)\n");
 	fprintf(stream, "      -e, --exe=FILE         name of the executable program file or path name\n");
+	fprintf(stream, "      -A, --all-instances    with --exe, limit all the running instances of FILE\n");
+	fprintf(stream, "                             as one group, sharing the limit\n");
+	fprintf(stream, "      -R, --rules=FILE       keep running and limit every process matching a rule\n");
+	fprintf(stream, "                             of FILE, reloaded when it changes (-l limits them all)\n");
 	fprintf(stream, "      COMMAND [ARGS]         run this command and limit it (implies -z)\n");
 	fprintf(stream, "\nReport bugs to <marlonx80@hotmail.com>.\n");
 	exit(exit_code);
@@ -167,6 +277,67 @@ static void increase_priority(void)
 	}
 }
 
+/* the cpu time of each member is read through a descriptor of its own,
+raise the limit on open files as far as allowed */
+static void raise_file_limit(void)
+{
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) != 0 || files.rlim_cur == files.rlim_max)
+		return;
+	files.rlim_cur = files.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &files) != 0 && verbose)
+		printf("Warning: Cannot raise the limit on open files.\n");
+}
+
+/* make the wake-ups of the limiter as punctual as possible, the processes
+it limits can no longer delay them, it must never spin */
+static void set_realtime(void)
+{
+	if (rt_priority > 0)
+	{
+#if defined(__linux__) || defined(__FreeBSD__)
+		struct sched_param param;
+		int policy = SCHED_FIFO;
+#ifdef SCHED_RESET_ON_FORK
+		/* the commands started by cpulimit must not inherit the priority */
+		policy |= SCHED_RESET_ON_FORK;
+#endif
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_priority;
+		if (sched_setscheduler(0, policy, &param) != 0)
+			fprintf(stderr, "Warning: Cannot set real-time priority %d: %s\n", rt_priority, strerror(errno));
+		else if (verbose)
+			printf("Real-time priority set to %d.\n", rt_priority);
+#else
+		fprintf(stderr, "Warning: Real-time priority not supported on this system\n");
+#endif
+#ifdef MCL_CURRENT
+		/* page faults would delay the wake-ups too */
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+			fprintf(stderr, "Warning: Cannot lock the memory: %s\n", strerror(errno));
+#endif
+#if defined(__linux__) && defined(PR_SET_TIMERSLACK)
+		/* the default slack of 50 us is too coarse */
+		prctl(PR_SET_TIMERSLACK, 1000UL, 0, 0, 0);
+#endif
+	}
+	if (affinity_cpu >= 0)
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (affinity_cpu < CPU_SETSIZE)
+			CPU_SET(affinity_cpu, &set);
+		if (affinity_cpu >= CPU_SETSIZE || sched_setaffinity(0, sizeof(set), &set) != 0)
+			fprintf(stderr, "Warning: Cannot run on cpu %d: %s\n", affinity_cpu, strerror(errno));
+		else if (verbose)
+			printf("Running on cpu %d.\n", affinity_cpu);
+#else
+		fprintf(stderr, "Warning: Cpu affinity not supported on this system\n");
+#endif
+	}
+}
+
 /* Get the number of CPUs */
 static int get_ncpu(void)
 {
@@ -205,41 +376,571 @@ static pid_t get_pid_max(void)
 #endif
 }
 
+/* parse a nested group in the form PID:N */
+static int parse_subgroup(const char *arg, struct subgroup *group)
+{
+	char *end;
+	long value = strtol(arg, &end, 10);
+	if (end == arg || *end != ':' || value <= 1 || value >= get_pid_max() || value == cpulimit_pid)
+		return -1;
+	group->pid = (pid_t)value;
+	arg = end + 1;
+	value = strtol(arg, &end, 10);
+	if (end == arg || *end != '\0' || value < 0 || value > 100 * NCPU)
+		return -1;
+	group->limit = value / 100.0;
+	return 0;
+}
+
+/* work-conserving mode: the limit is enforced under cpu pressure */
+static int enforce_system_pressure(void *data, double own)
+{
+	struct cpu_pressure *pressure = (struct cpu_pressure *)data;
+	struct list_node *node;
+	double own_wait = 0, delay;
+	/* the waits of the members since the last check, to tell them apart
+	from the competitors in PSI */
+	for (node = pgroup.proclist->first; pressure->use_psi && node != NULL; node = node->next)
+	{
+		struct process *p = (struct process *)node->data;
+		if (read_run_delay(p->pid, &delay) != 0)
+			continue;
+		if (p->run_delay >= 0)
+			own_wait += MAX(delay - p->run_delay, 0);
+		p->run_delay = delay;
+	}
+	return enforce_under_pressure(pressure, own, own_wait);
+}
+
+static const struct limiter_pressure system_pressure = {&pressure, enforce_system_pressure};
+
+/* send a signal to all the members of the process group */
+static void signal_process_group(int sig)
+{
+	struct list_node *node;
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)(node->data);
+		kill(p->pid, sig);
+		metrics.signals++;
+	}
+}
+
+/* send SIGCONT to all the members of the process group */
+static void resume_process_group(void)
+{
+	struct list_node *node;
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)(node->data);
+		kill(p->pid, SIGCONT);
+		metrics.signals++;
+	}
+}
+
+/* most slots between two searches of the members, they are searched at
+every slot after a change, and less and less often while nothing changes */
+#define DISCOVERY_SLOTS_MAX 16
+
+/* apply the commands received on the control socket
+changes take effect from the slot that is about to start */
+static void process_control_commands(double *limit, int *paused, double pcpu, double credit, int contended)
+{
+	struct control_command cmd;
+	while (read_control_command(&control, &cmd) > 0)
+	{
+		struct list_node *node;
+		pid_t target = (pid_t)cmd.value;
+		switch (cmd.type)
+		{
+		case CONTROL_SET_LIMIT:
+			if (cmd.value < 0 || cmd.value > 100 * NCPU)
+			{
+				reply_control_command(&control, &cmd, "error: limit must be in the range 0-%d00\n", NCPU);
+				break;
+			}
+			*limit = cmd.value / 100.0;
+			if (verbose)
+				printf("Limit changed to %ld%%\n", cmd.value);
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_ADD_TARGET:
+			if (target <= 1 || target >= get_pid_max() || target == cpulimit_pid ||
+				find_process_by_pid(target) <= 0)
+			{
+				reply_control_command(&control, &cmd, "error: cannot control process %ld\n", cmd.value);
+				break;
+			}
+			if (add_target(&pgroup, target) != 0)
+			{
+				reply_control_command(&control, &cmd, "error: process %ld is already a target\n", cmd.value);
+				break;
+			}
+			if (verbose)
+				printf("Process %ld added to the targets\n", cmd.value);
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_REMOVE_TARGET:
+			if (remove_target(&pgroup, target) != 0)
+			{
+				reply_control_command(&control, &cmd, "error: process %ld is not a target\n", cmd.value);
+				break;
+			}
+			/* the leaving processes must not stay stopped */
+			resume_process_group();
+			if (verbose)
+				printf("Process %ld removed from the targets\n", cmd.value);
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_SET_CHILDREN:
+			if (!cmd.value)
+				resume_process_group();
+			set_include_children(&pgroup, cmd.value != 0);
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_PAUSE:
+			if (!*paused)
+				resume_process_group();
+			*paused = 1;
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_RESUME:
+			*paused = 0;
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		case CONTROL_STATS:
+			reply_control_command(&control, &cmd, "limit %.2f\n", *limit * 100);
+			reply_control_command(&control, &cmd, "cpu %.2f\n", pcpu < 0 ? 0 : pcpu * 100);
+			reply_control_command(&control, &cmd, "active-rate %.2f\n", MAX(budget_root(&budget)->workingrate, 0) * 100);
+			reply_control_command(&control, &cmd, "paused %d\n", *paused);
+			if (burst > 0)
+				reply_control_command(&control, &cmd, "burst-credit %.0f\n", credit);
+			if (hard_limit >= 0)
+				reply_control_command(&control, &cmd, "pressure %d\n", contended);
+			reply_control_command(&control, &cmd, "include-children %d\n", pgroup.include_children);
+			for (node = pgroup.targets->first; node != NULL; node = node->next)
+				reply_control_command(&control, &cmd, "target %ld\n", (long)*(pid_t *)node->data);
+			for (node = budget.nodes->first->next; node != NULL; node = node->next)
+			{
+				const struct budget_node *group = (const struct budget_node *)node->data;
+				reply_control_command(&control, &cmd, "group %ld %.2f %.2f %.2f %.2f\n", (long)group->pid,
+									  group->limit * 100, MAX(group->usage, 0) * 100, group->share * 100,
+									  MAX(group->workingrate, 0) * 100);
+			}
+			reply_control_command(&control, &cmd, "members %d\n", pgroup.proclist->count);
+			for (node = pgroup.proclist->first; node != NULL; node = node->next)
+			{
+				const struct process *p = (const struct process *)(node->data);
+				reply_control_command(&control, &cmd, "member %ld %.2f\n",
+									  (long)p->pid, p->cpu_usage < 0 ? 0 : p->cpu_usage * 100);
+			}
+			reply_control_command(&control, &cmd, "ok\n");
+			break;
+		}
+	}
+}
+
+/* signal at once the process groups (pgids) made only of members,
+those which cannot be signalled any more go back to per-process signals */
+static void signal_whole_pgids(int sig)
+{
+	struct list_node *node = pgroup.pgids->first;
+	while (node != NULL)
+	{
+		struct list_node *next_node = node->next;
+		if (kill(-*(pid_t *)node->data, sig) != 0)
+			destroy_node(pgroup.pgids, node);
+		metrics.signals++;
+		node = next_node;
+	}
+}
+
+/* whole pgids are used only if there are no nested groups, a pgid would
+span several of them */
+#define use_whole_pgids() (budget.nodes->count == 1)
+
+/* stop a child forked by a member during the working slice */
+static void stop_child(void *data, struct process *p)
+{
+	(void)data;
+	metrics.signals++;
+	kill(p->pid, SIGSTOP);
+	forks_seen = 1;
+}
+
+/* stop the members of a group at the end of its working slice, then
+the children they forked in the meantime, which are not members yet */
+static void stop_budget_node(void *data, struct budget_node *group)
+{
+	struct list_node *node = group->members->first;
+	struct timespec signal_start, signal_end;
+	int whole_pgids = use_whole_pgids();
+	(void)data;
+	get_time(&signal_start);
+	if (whole_pgids)
+		signal_whole_pgids(SIGSTOP);
+	while (node != NULL)
+	{
+		struct list_node *next_node = node->next;
+		struct process *proc = (struct process *)(node->data);
+		if (whole_pgids && is_whole_pgid(&pgroup, proc->pgid))
+		{
+			node = next_node;
+			continue;
+		}
+		metrics.signals++;
+		if (kill(proc->pid, SIGSTOP) != 0)
+		{
+			struct list_node *member = locate_node(pgroup.proclist, &proc->pid);
+			/* process is dead, remove it from family */
+			if (verbose)
+				fprintf(stderr, "SIGSTOP failed. Process %ld dead!\n", (long)proc->pid);
+			/* remove process from group */
+			delete_node(group->members, node);
+			if (member != NULL)
+			{
+				delete_node(pgroup.proclist, member);
+				remove_process(&pgroup, proc->pid);
+			}
+		}
+		node = next_node;
+	}
+	capture_children(&pgroup, group->members, stop_child, NULL);
+	get_time(&signal_end);
+	record_value(&signal_hist, timediff_in_ms(&signal_end, &signal_start) * 1000);
+}
+
+/* resume all the members at the beginning of the slot */
+static void resume_members(void *data)
+{
+	struct list_node *node = pgroup.proclist->first;
+	struct timespec signal_start, signal_end;
+	int whole_pgids = use_whole_pgids();
+	(void)data;
+	get_time(&signal_start);
+	if (whole_pgids)
+		signal_whole_pgids(SIGCONT);
+	while (node != NULL)
+	{
+		struct list_node *next_node = node->next;
+		struct process *proc = (struct process *)(node->data);
+		if (whole_pgids && is_whole_pgid(&pgroup, proc->pgid))
+		{
+			node = next_node;
+			continue;
+		}
+		metrics.signals++;
+		if (kill(proc->pid, SIGCONT) != 0)
+		{
+			/* process is dead, remove it from family */
+			if (verbose)
+				fprintf(stderr, "SIGCONT failed. Process %ld dead!\n", (long)proc->pid);
+			/* remove process from group */
+			delete_node(pgroup.proclist, node);
+			remove_process(&pgroup, proc->pid);
+		}
+		node = next_node;
+	}
+	get_time(&signal_end);
+	record_value(&signal_hist, timediff_in_ms(&signal_end, &signal_start) * 1000);
+}
+
+/* sleep until offset_nsec after start, recording how late the wake-up was
+the processes may have been signalled past the end of the slice already */
+static void sleep_until(void *data, const struct timespec *start, double offset_nsec)
+{
+	struct timespec now, t;
+	double late;
+	(void)data;
+	/* a child exited, the slot ends at once */
+	if (child_flag)
+		return;
+	get_time(&now);
+	/* in us */
+	late = timediff_in_ms(&now, start) * 1000 - offset_nsec / 1000;
+	if (late < 0)
+	{
+		nsec2timespec(-late * 1000, &t);
+		/* a child exiting since the check above ends the sleep too */
+		pselect(0, NULL, NULL, NULL, &t, &sleep_mask);
+		get_time(&now);
+		late = timediff_in_ms(&now, start) * 1000 - offset_nsec / 1000;
+	}
+	/* interrupted sleeps end early */
+	late = MAX(late, 0);
+	record_value(&wakeup_hist, late);
+	wakeup.count++;
+	wakeup.total += late;
+	wakeup.max = MAX(wakeup.max, late);
+}
+
+static void get_now(void *data, struct timespec *t)
+{
+	(void)data;
+	get_time(t);
+}
+
+/* the real processes, on the system clock */
+static const struct limiter_clock system_clock = {NULL, get_now, sleep_until};
+static const struct limiter_actuator process_actuator = {NULL, resume_members, stop_budget_node};
+
+/* cycles between two searches of the processes matching the rules, when
+the executions of new processes are not notified */
+#define RULES_SCAN_CYCLES 20
+
+/* make the process a target if it matches a rule, it owns a nested
+group limited by the rule */
+static void attach_rule_target(const struct process *proc)
+{
+	const struct rule *rule;
+	if (proc->pid == cpulimit_pid || locate_elem(pgroup.targets, &proc->pid) != NULL ||
+		(rule = match_rules(&rules, proc)) == NULL)
+		return;
+	add_target(&pgroup, proc->pid);
+	set_target_children(&pgroup, proc->pid, rule->include_children);
+	add_budget_node(&budget, proc->pid, rule->limit);
+	if (verbose)
+		printf("Process %ld matches the rule at line %d\n", (long)proc->pid, rule->line);
+}
+
+/* make the processes matching a rule targets
+pid: the only process to check, 0 to search all of them */
+static void attach_rule_targets(pid_t pid)
+{
+	struct process_iterator it;
+	struct process proc;
+	struct process_filter filter;
+	filter.pid = pid;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	init_process_iterator(&it, &filter);
+	while (get_next_process(&it, &proc) != -1)
+		attach_rule_target(&proc);
+	close_process_iterator(&it);
+}
+
+/* forget the targets which are gone, or all of them */
+static void detach_rule_targets(int all)
+{
+	struct list_node *node = pgroup.targets->first;
+	while (node != NULL)
+	{
+		struct list_node *next_node = node->next;
+		pid_t target = *(pid_t *)node->data;
+		if (all || locate_elem(pgroup.proclist, &target) == NULL)
+		{
+			remove_budget_node(&budget, target);
+			remove_target(&pgroup, target);
+		}
+		node = next_node;
+	}
+}
+
+/* follow the changes of the rules file and check the processes which
+executed a program, all the processes if they are not known
+scan: 1 if the processes must be searched anyway */
+static void update_rule_targets(int scan)
+{
+	static int cycles = 0;
+	struct timespec no_wait = {0, 0};
+	int i;
+	if (rules_changed(&rules) && reload_rules(&rules, NCPU) == 0)
+	{
+		if (verbose)
+			printf("Rules reloaded from %s: %d rules\n", rules.path, rules.count);
+		/* the processes leaving must not stay stopped */
+		resume_process_group();
+		detach_rule_targets(1);
+		scan = 1;
+	}
+	else
+	{
+		detach_rule_targets(0);
+	}
+	wait_exec_event(&rule_watch, &no_wait);
+	if (rule_watch.lost || (!rule_watch.complete && ++cycles >= RULES_SCAN_CYCLES))
+		scan = 1;
+	if (scan)
+	{
+		attach_rule_targets(0);
+		cycles = 0;
+	}
+	else
+	{
+		for (i = 0; i < rule_watch.count; i++)
+			attach_rule_targets(rule_watch.pids[i]);
+	}
+	clear_exec_events(&rule_watch);
+}
+
+/* reap the children exited, the command and the orphans it left */
+static void reap_children(void)
+{
+	int status;
+	pid_t ret;
+	child_flag = 0;
+	while ((ret = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		if (ret == command_pid)
+		{
+			command_status = status;
+			command_done = 1;
+		}
+	}
+}
+
+/* let the command start */
+static void open_gate(void)
+{
+	if (gate_fd < 0)
+		return;
+	close(gate_fd);
+	gate_fd = -1;
+}
+
+static void print_loop_stats(void)
+{
+	printf("\nControl loop statistics:\n");
+	print_histogram(&scan_hist, stdout);
+	print_histogram(&signal_hist, stdout);
+	print_histogram(&wakeup_hist, stdout);
+	print_histogram(&error_hist, stdout);
+	fflush(stdout);
+}
+
 static void limit_process(pid_t pid, double limit, int include_children)
 {
-	/* slice of the slot in which the process is allowed to run */
-	struct timespec twork;
-	/* slice of the slot in which the process is stopped */
-	struct timespec tsleep;
 	/* generic list item */
 	struct list_node *node;
 	/* counter */
 	int c = 0;
+	int i;
 
-	/* rate at which we are keeping active the processes (range 0-1) */
-	/* 1 means that the process are using all the twork slice */
-	double workingrate = -1;
+	/* total cpu usage estimated in the last cycle */
+	double last_pcpu = -1;
+
+	/* enforcement suspended through the control socket */
+	int paused = 0;
+
+	/* bursts, work-conserving mode and free run */
+	struct limiter_modes modes;
+
+	/* some process groups (pgids) are signalled at once */
+	int last_pgids = 0;
+
+	/* slots between two searches of the members, and before the next one */
+	int discovery_slots = 1;
+	int next_discovery = 0;
+
+	/* the processes matching the rules must be searched */
+	int rescan = 0;
+	struct timespec idle_time = {2, 0};
+
+	init_histogram(&scan_hist, "scan", "us", 1);
+	init_histogram(&signal_hist, "signal loop", "us", 1);
+	init_histogram(&wakeup_hist, "wake-up delay", "us", 1);
+	/* with a resolution of 0.01% */
+	init_histogram(&error_hist, "tracking error", "%", 100);
 
 	/* get a better priority */
 	increase_priority();
+	set_realtime();
+	raise_file_limit();
 
-	/* build the family */
-	init_process_group(&pgroup, pid, include_children);
+	/* build the family, the processes matching the rules are attached
+	below, the others are never searched */
+	init_process_group(&pgroup, rules_path != NULL ? -1 : pid, include_children);
+	if (target_name != NULL)
+	{
+		/* pid is one of the instances, all of them are targets */
+		remove_target(&pgroup, pid);
+		set_target_name(&pgroup, target_name);
+		update_process_group(&pgroup);
+	}
+	if (reaper_pid > 0 && include_children)
+	{
+		/* the orphans adopted by cpulimit stay in the family */
+		remove_target(&pgroup, pid);
+		set_target_reaper(&pgroup, reaper_pid);
+		update_process_group(&pgroup);
+	}
+	init_budget_tree(&budget, limit);
+	init_limiter_modes(&modes, burst, hard_limit);
+	for (i = 0; i < subgroup_count; i++)
+	{
+		/* the nested groups are limited even outside of the family */
+		add_budget_node(&budget, subgroups[i].pid, subgroups[i].limit);
+		add_target(&pgroup, subgroups[i].pid);
+	}
+	if (rules_path != NULL)
+	{
+		/* the targets are the processes matching the rules */
+		attach_rule_targets(0);
+		update_process_group(&pgroup);
+	}
 
-	if (verbose)
+	if (verbose && rules_path != NULL)
+		printf("Processes matching the rules: %d\n", pgroup.targets->count);
+	else if (verbose)
 		printf("Members in the process group owned by %ld: %d\n",
-			   (long)pgroup.target_pid, pgroup.proclist->count);
+			   (long)pid, pgroup.proclist->count);
 
 	while (!quit_flag)
 	{
 		/* total cpu actual usage (range 0-1) */
 		/* 1 means that the processes are using 100% cpu */
 		double pcpu = -1;
+		struct timespec scan_start, scan_end;
+		/* the modes of the last slot */
+		int enforcing, free_run;
 
-		double twork_total_nsec, tsleep_total_nsec;
+		process_control_commands(&limit, &paused, last_pcpu, modes.credit, modes.enforcing);
 
-		update_process_group(&pgroup);
+		if (child_flag)
+			reap_children();
+
+		if (report_flag)
+		{
+			print_loop_stats();
+			report_flag = 0;
+		}
+
+		if (rules_path != NULL)
+		{
+			update_rule_targets(rescan);
+			rescan = 0;
+		}
+
+		get_time(&scan_start);
+		if (--next_discovery <= 0 || forks_seen)
+		{
+			/* the members are searched, the sooner the more they change */
+			if (update_process_group(&pgroup) || forks_seen)
+				discovery_slots = 1;
+			else
+				discovery_slots = MIN(2 * discovery_slots, DISCOVERY_SLOTS_MAX);
+			next_discovery = discovery_slots;
+			forks_seen = 0;
+		}
+		else if (sample_process_group(&pgroup))
+		{
+			/* some members left, their children may have too */
+			discovery_slots = next_discovery = 1;
+		}
+		get_time(&scan_end);
+		record_value(&scan_hist, timediff_in_ms(&scan_end, &scan_start) * 1000);
+		metrics.scan_time += timediff_in_ms(&scan_end, &scan_start);
+		metrics.scans++;
 
+		if (pgroup.proclist->count == 0 && rules_path != NULL)
+		{
+			/* nothing to limit until a matching process starts, the
+			rules file is checked meanwhile, the executions notified are
+			checked by the next update */
+			wait_exec_event(&rule_watch, &idle_time);
+			rescan = !rule_watch.complete;
+			continue;
+		}
 		if (pgroup.proclist->count == 0)
 		{
 			if (verbose)
@@ -247,6 +948,12 @@ static void limit_process(pid_t pid, double limit, int include_children)
 			break;
 		}
 
+		if (verbose && pgroup.pgids->count != last_pgids)
+		{
+			printf("Process groups signalled at once: %d\n", pgroup.pgids->count);
+			last_pgids = pgroup.pgids->count;
+		}
+
 		/* estimate how much the controlled processes are using the cpu in the working interval */
 		for (node = pgroup.proclist->first; node != NULL; node = node->next)
 		{
@@ -260,94 +967,126 @@ static void limit_process(pid_t pid, double limit, int include_children)
 			pcpu += proc->cpu_usage;
 		}
 
+		if (paused)
+		{
+			struct timespec pause_start;
+			/* the processes run freely, keep the controller state */
+			last_pcpu = pcpu;
+			record_metrics(&metrics, &pgroup, limit, MAX(pcpu, 0), 1);
+			open_gate();
+			get_time(&pause_start);
+			sleep_until(NULL, &pause_start, (double)TIME_SLOT * 1000);
+			continue;
+		}
+
+		/* usage against the limit of the last slot */
+		if (pcpu >= 0)
+			record_value(&error_hist, (pcpu - budget_root(&budget)->limit) * 100);
+
 		/* adjust work and sleep time slices */
-		if (pcpu < 0)
+		enforcing = modes.enforcing;
+		budget_root(&budget)->limit = update_limiter_modes(&modes, limit, NCPU, &pgroup, &system_pressure);
+		if (verbose && modes.enforcing && !enforcing)
+			printf("CPU pressure detected, enforcing the limit\n");
+		else if (verbose && !modes.enforcing && enforcing)
+			printf("No CPU pressure, allowing up to %.0f%%\n", hard_limit * 100);
+		update_budget_tree(&budget, &pgroup);
+		free_run = modes.free_run;
+		if (update_free_run(&modes, &budget, &pgroup) && !free_run)
 		{
-			/* it's the 1st cycle, initialize workingrate */
-			pcpu = limit;
-			workingrate = limit;
+			if (verbose)
+				printf("Usage under the limit, the processes run freely\n");
+			/* they were stopped at the end of the last slot */
+			resume_process_group();
 		}
-		else
+		else if (free_run && !modes.free_run && verbose)
+			printf("Usage close to the limit, enforcing it again\n");
+		if (pcpu < 0)
 		{
-			/* adjust workingrate */
-			workingrate = workingrate * limit / MAX(pcpu, EPSILON);
+			/* it's the 1st cycle */
+			pcpu = limit;
 		}
-		workingrate = MAX(MIN(workingrate, 1 - EPSILON), EPSILON);
-
-		twork_total_nsec = (double)TIME_SLOT * 1000 * workingrate;
-		nsec2timespec(twork_total_nsec, &twork);
-
-		tsleep_total_nsec = (double)TIME_SLOT * 1000 - twork_total_nsec;
-		nsec2timespec(tsleep_total_nsec, &tsleep);
+		last_pcpu = pcpu;
 
 		if (verbose)
 		{
+			const struct budget_node *root = budget_root(&budget);
+			double workingrate = MAX(root->workingrate, 0);
+			double twork_total_nsec = (double)TIME_SLOT * 1000 * workingrate;
+			double tsleep_total_nsec = (double)TIME_SLOT * 1000 - twork_total_nsec;
 			if (c % 200 == 0)
-				printf("\n    %%CPU    work quantum    sleep quantum    active rate\n");
+				printf("\n    %%CPU    work quantum    sleep quantum    active rate%s    wake-up delay\n",
+					   burst > 0 ? "    burst credit" : "");
 			if (c % 10 == 0 && c > 0)
-				printf("%7.2f%%    %9.0f us    %10.0f us    %10.2f%%\n", pcpu * 100, twork_total_nsec / 1000, tsleep_total_nsec / 1000, workingrate * 100);
-		}
-
-		/* resume processes */
-		node = pgroup.proclist->first;
-		while (node != NULL)
-		{
-			struct list_node *next_node = node->next;
-			struct process *proc = (struct process *)(node->data);
-			if (kill(proc->pid, SIGCONT) != 0)
 			{
-				/* process is dead, remove it from family */
-				if (verbose)
-					fprintf(stderr, "SIGCONT failed. Process %ld dead!\n", (long)proc->pid);
-				/* remove process from group */
-				delete_node(pgroup.proclist, node);
-				remove_process(&pgroup, proc->pid);
+				printf("%7.2f%%    %9.0f us    %10.0f us    %10.2f%%", pcpu * 100, twork_total_nsec / 1000, tsleep_total_nsec / 1000, workingrate * 100);
+				if (burst > 0)
+					printf("    %9.0f ms", modes.credit);
+				printf("    %5.0f/%-5.0f us\n",
+					   wakeup.count > 0 ? wakeup.total / wakeup.count : 0, wakeup.max);
+				wakeup.count = 0;
+				wakeup.total = wakeup.max = 0;
+				for (node = budget.nodes->first->next; node != NULL; node = node->next)
+				{
+					const struct budget_node *group = (const struct budget_node *)node->data;
+					printf("  group %ld: %7.2f%% cpu, %7.2f%% share, %7.2f%% active rate\n",
+						   (long)group->pid, MAX(group->usage, 0) * 100, group->share * 100,
+						   MAX(group->workingrate, 0) * 100);
+				}
 			}
-			node = next_node;
 		}
 
-		/* now processes are free to run (same working slice for all) */
-		sleep_timespec(&twork);
+		record_metrics(&metrics, &pgroup, budget_root(&budget)->limit, pcpu,
+					   MAX(budget_root(&budget)->workingrate, 0));
 
-		if (tsleep.tv_nsec > 0 || tsleep.tv_sec > 0)
+		if (trace.file != NULL)
 		{
-			/* stop processes only if tsleep>0 */
-			node = pgroup.proclist->first;
-			while (node != NULL)
-			{
-				struct list_node *next_node = node->next;
-				struct process *proc = (struct process *)(node->data);
-				if (kill(proc->pid, SIGSTOP) != 0)
-				{
-					/* process is dead, remove it from family */
-					if (verbose)
-						fprintf(stderr, "SIGSTOP failed. Process %ld dead!\n", (long)proc->pid);
-					/* remove process from group */
-					delete_node(pgroup.proclist, node);
-					remove_process(&pgroup, proc->pid);
-				}
-				node = next_node;
-			}
-			/* now the processes are sleeping */
-			sleep_timespec(&tsleep);
+			struct trace_cycle cycle;
+			cycle.limit = budget_root(&budget)->limit;
+			cycle.pcpu = pcpu;
+			cycle.workingrate = MAX(budget_root(&budget)->workingrate, 0);
+			cycle.twork = TIME_SLOT * cycle.workingrate;
+			cycle.tsleep = TIME_SLOT - cycle.twork;
+			write_trace_cycle(&trace, &pgroup, &cycle);
+		}
+
+		/* now processes are free to run, each group for its working slice */
+		open_gate();
+		if (modes.free_run)
+		{
+			/* nothing to enforce, only sample */
+			struct timespec slot_start;
+			get_time(&slot_start);
+			sleep_until(NULL, &slot_start, (double)TIME_SLOT * 1000);
+		}
+		else
+		{
+			run_control_slot(&budget, &system_clock, &process_actuator);
 		}
 		c = (c + 1) % 200;
 	}
 
 	if (quit_flag)
 	{
-		for (node = pgroup.proclist->first; node != NULL; node = node->next)
-		{
-			const struct process *p = (const struct process *)(node->data);
-			kill(p->pid, SIGCONT);
-		}
+		/* the command and the descendants adopted quit too, the terminal
+		signals them already */
+		if (command_pid > 0 && quit_alone)
+			signal_process_group(quit_flag);
+		resume_process_group();
 	}
 
+	if (verbose || report_flag)
+		print_loop_stats();
+
+	close_budget_tree(&budget);
 	close_process_group(&pgroup);
 }
 
 static void quit_handler(void)
 {
+	close_control_socket(&control);
+	close_metrics(&metrics);
+	close_trace(&trace);
 	if (quit_flag)
 	{
 		/* fix ^C little problem */
@@ -361,6 +1100,7 @@ int main(int argc, char *argv[])
 	char *exe = NULL;
 	int perclimit = 0;
 	int exe_ok = 0;
+	int all_instances = 0;
 	int pid_ok = 0;
 	int limit_ok = 0;
 	pid_t pid = 0;
@@ -368,18 +1108,30 @@ int main(int argc, char *argv[])
 	int command_mode;
 
 	/* parse arguments */
+	char *endptr;
 	int next_option;
 	int option_index = 0;
 	/* A string listing valid short options letters */
-	const char *short_options = "+p:e:l:vzih";
+	const char *short_options = "+p:e:AR:l:vzib:w:g:c:r:a:m:t:h";
 	/* An array describing valid long options */
 	const struct option long_options[] = {
 		{"pid", required_argument, NULL, 'p'},
 		{"exe", required_argument, NULL, 'e'},
+		{"all-instances", no_argument, NULL, 'A'},
+		{"rules", required_argument, NULL, 'R'},
 		{"limit", required_argument, NULL, 'l'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"lazy", no_argument, NULL, 'z'},
 		{"include-children", no_argument, NULL, 'i'},
+		{"burst", required_argument, NULL, 'b'},
+		{"work-conserving", required_argument, NULL, 'w'},
+		{"group", required_argument, NULL, 'g'},
+		{"control", required_argument, NULL, 'c'},
+		{"realtime", required_argument, NULL, 'r'},
+		{"affinity", required_argument, NULL, 'a'},
+		{"metrics", required_argument, NULL, 'm'},
+		{"metrics-interval", required_argument, NULL, 'M'},
+		{"trace", required_argument, NULL, 't'},
 		{"help", no_argument, NULL, 'h'},
 		{0, 0, 0, 0}};
 
@@ -387,10 +1139,13 @@ int main(int argc, char *argv[])
 
 	struct timespec wait_time = {2, 0};
 
+	struct exec_watch watch;
+
 	struct sigaction sa;
 
 	static char program_base_name[PATH_MAX + 1];
 
+	control.fd = -1;
 	atexit(quit_handler);
 
 	/* get program name */
@@ -401,6 +1156,12 @@ int main(int argc, char *argv[])
 	cpulimit_pid = getpid();
 	/* get cpu count */
 	NCPU = get_ncpu();
+	/* the processes can be read from a copy of /proc (fixtures of the tests) */
+	if (getenv("CPULIMIT_PROCFS") != NULL && set_procfs_root(getenv("CPULIMIT_PROCFS")) != 0)
+	{
+		fprintf(stderr, "Error: invalid CPULIMIT_PROCFS\n");
+		exit(1);
+	}
 
 	do
 	{
@@ -415,6 +1176,12 @@ int main(int argc, char *argv[])
 			exe = optarg;
 			exe_ok = 1;
 			break;
+		case 'A':
+			all_instances = 1;
+			break;
+		case 'R':
+			rules_path = optarg;
+			break;
 		case 'l':
 			perclimit = atoi(optarg);
 			limit_ok = 1;
@@ -428,6 +1195,66 @@ int main(int argc, char *argv[])
 		case 'i':
 			include_children = 1;
 			break;
+		case 'b':
+			burst = strtod(optarg, &endptr);
+			if (endptr == optarg || *endptr != '\0' || burst < 0)
+			{
+				fprintf(stderr, "Error: Invalid value for argument BURST\n");
+				print_usage(stderr, 1);
+			}
+			break;
+		case 'w':
+			hard_limit = strtol(optarg, &endptr, 10) / 100.0;
+			if (endptr == optarg || *endptr != '\0')
+			{
+				fprintf(stderr, "Error: Invalid value for argument WORK-CONSERVING\n");
+				print_usage(stderr, 1);
+			}
+			break;
+		case 'g':
+			subgroups = (struct subgroup *)realloc(subgroups, (subgroup_count + 1) * sizeof(struct subgroup));
+			if (subgroups == NULL)
+				exit(2);
+			if (parse_subgroup(optarg, &subgroups[subgroup_count]) != 0)
+			{
+				fprintf(stderr, "Error: Invalid value for argument GROUP\n");
+				print_usage(stderr, 1);
+			}
+			subgroup_count++;
+			break;
+		case 'c':
+			control_path = optarg;
+			break;
+		case 'r':
+			rt_priority = strtol(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr != '\0' || rt_priority < 1)
+			{
+				fprintf(stderr, "Error: Invalid value for argument REALTIME\n");
+				print_usage(stderr, 1);
+			}
+			break;
+		case 'a':
+			affinity_cpu = strtol(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr != '\0' || affinity_cpu < 0)
+			{
+				fprintf(stderr, "Error: Invalid value for argument AFFINITY\n");
+				print_usage(stderr, 1);
+			}
+			break;
+		case 'm':
+			metrics_spec = optarg;
+			break;
+		case 'M':
+			metrics_interval = strtol(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr != '\0' || metrics_interval < 1)
+			{
+				fprintf(stderr, "Error: Invalid value for argument METRICS-INTERVAL\n");
+				print_usage(stderr, 1);
+			}
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
 		case 'h':
 			print_usage(stdout, 1);
 			break;
@@ -452,6 +1279,12 @@ int main(int argc, char *argv[])
 		lazy = 1;
 	}
 
+	if (!limit_ok && rules_path != NULL)
+	{
+		/* each process is limited by its rule only */
+		perclimit = 100 * NCPU;
+		limit_ok = 1;
+	}
 	if (!limit_ok)
 	{
 		fprintf(stderr, "Error: You must specify a cpu limit percentage\n");
@@ -466,36 +1299,114 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (hard_limit >= 0 && (hard_limit < limit || hard_limit > NCPU))
+	{
+		fprintf(stderr, "Error: the work-conserving limit must be in the range %d-%d00\n", perclimit, NCPU);
+		print_usage(stderr, 1);
+		exit(1);
+	}
+	if (hard_limit >= 0 && init_cpu_pressure(&pressure) != 0)
+	{
+		fprintf(stderr, "Error: cannot measure the cpu pressure of the system\n");
+		exit(1);
+	}
+
 	command_mode = optind < argc;
-	if (exe_ok + pid_ok + command_mode == 0)
+	if (exe_ok + pid_ok + command_mode + (rules_path != NULL) == 0)
 	{
-		fprintf(stderr, "Error: You must specify one target process, either by name, pid, or command line\n");
+		fprintf(stderr, "Error: You must specify one target process, either by name, pid, command line, or rules\n");
 		print_usage(stderr, 1);
 		exit(1);
 	}
 
-	if (exe_ok + pid_ok + command_mode > 1)
+	if (exe_ok + pid_ok + command_mode + (rules_path != NULL) > 1)
 	{
-		fprintf(stderr, "Error: You must specify exactly one target process, either by name, pid, or command line\n");
+		fprintf(stderr, "Error: You must specify exactly one target process, either by name, pid, command line, or rules\n");
 		print_usage(stderr, 1);
 		exit(1);
 	}
 
+	if (rules_path != NULL)
+	{
+		if (subgroup_count > 0)
+		{
+			fprintf(stderr, "Error: --group cannot be used with --rules\n");
+			print_usage(stderr, 1);
+			exit(1);
+		}
+		if (load_rules(&rules, rules_path, NCPU) != 0)
+			exit(1);
+	}
+
+	if (all_instances)
+	{
+		if (!exe_ok)
+		{
+			fprintf(stderr, "Error: --all-instances requires --exe\n");
+			print_usage(stderr, 1);
+			exit(1);
+		}
+		target_name = exe;
+	}
+
 	/* all arguments are ok! */
-	sa.sa_handler = sig_handler;
-	sa.sa_flags = 0;
+	sa.sa_sigaction = quit_sig_handler;
+	sa.sa_flags = SA_SIGINFO;
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGINT, &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = sig_handler;
+	sa.sa_flags = 0;
+	sigaction(SIGUSR1, &sa, NULL);
+	sigprocmask(SIG_BLOCK, NULL, &sleep_mask);
 
 	/* print the number of available cpu */
 	if (verbose)
 		printf("%d cpu detected\n", NCPU);
 
+	if (control_path != NULL && open_control_socket(&control, control_path) != 0)
+	{
+		fprintf(stderr, "Error: cannot create the control socket %s: %s\n", control_path, strerror(errno));
+		exit(1);
+	}
+
+	if (metrics_spec != NULL && open_metrics(&metrics, metrics_spec, metrics_interval) != 0)
+	{
+		fprintf(stderr, "Error: cannot write the metrics to %s: %s\n", metrics_spec, strerror(errno));
+		exit(1);
+	}
+
+	if (trace_path != NULL)
+	{
+		struct trace_header header;
+		header.limit = limit;
+		header.ncpu = NCPU;
+		header.time_slot = TIME_SLOT;
+		header.flags = subgroup_count > 0 || rules_path != NULL ? TRACE_NESTED_GROUPS : 0;
+		if (open_trace_writer(&trace, trace_path, &header) != 0)
+		{
+			fprintf(stderr, "Error: cannot write the trace to %s: %s\n", trace_path, strerror(errno));
+			exit(1);
+		}
+	}
+
+	if (rules_path != NULL)
+	{
+		/* daemon mode */
+		if (open_exec_watch(&rule_watch, NULL) == 0 && verbose)
+			printf("Watching the executions with the proc connector\n");
+		limit_process(0, limit, 1);
+		close_exec_watch(&rule_watch);
+		free_rules(&rules);
+		return 0;
+	}
+
 	if (command_mode)
 	{
 		int i;
 		pid_t child;
+		/* the command waits for the limiter on this pipe */
+		int gate[2];
 		/* executable file */
 		const char *cmd = argv[optind];
 		/* command line arguments */
@@ -518,6 +1429,20 @@ int main(int argc, char *argv[])
 			printf("'\n");
 		}
 
+		if (pipe(gate) != 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+		/* the exit of the command ends the current slot at once, its stops
+		and resumes are not notified */
+		sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigaction(SIGCHLD, &sa, NULL);
+#if defined(__linux__) && defined(PR_SET_CHILD_SUBREAPER)
+		/* the orphans of the command are adopted by cpulimit, not by init */
+		if (include_children && prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) == 0)
+			reaper_pid = getpid();
+#endif
+
 		child = fork();
 		if (child < 0)
 		{
@@ -526,49 +1451,68 @@ int main(int argc, char *argv[])
 		else if (child == 0)
 		{
 			/* target process code */
-			int ret = execvp(cmd, cmd_args);
+			int ret;
+			char c;
+			/* it stays in the process group of cpulimit, the job control
+			of the shell stops, resumes and interrupts both at once */
+			/* start once the limiter is ready (or gone) */
+			close(gate[1]);
+			while (read(gate[0], &c, 1) < 0 && errno == EINTR)
+				;
+			close(gate[0]);
+			ret = execvp(cmd, cmd_args);
 			/* if we are here there was an error, show it */
 			perror("Error");
 			exit(ret);
 		}
 		else
 		{
-			/* parent code */
-			pid_t limiter;
+			/* parent code, the limiter */
+			sigset_t chld;
+			sigemptyset(&chld);
+			sigaddset(&chld, SIGCHLD);
+			/* SIGCHLD is only delivered while sleeping, so that no sleep
+			starts after the command exited (the command is not blocked) */
+			sigprocmask(SIG_BLOCK, &chld, NULL);
 			free(cmd_args);
-			limiter = fork();
-			if (limiter < 0)
-			{
-				exit(EXIT_FAILURE);
-			}
-			else if (limiter > 0)
+			close(gate[0]);
+			gate_fd = gate[1];
+			command_pid = child;
+			if (verbose)
+				printf("Limiting process %ld\n", (long)child);
+			limit_process(child, limit, include_children);
+			open_gate();
+			reap_children();
+			/* interrupted, the exit of the command is waited for */
+			while (!command_done && waitpid(child, &command_status, 0) < 0 && errno == EINTR)
+				;
+			if (WIFEXITED(command_status))
 			{
-				/* parent */
-				int status_process;
-				int status_limiter;
-				waitpid(child, &status_process, 0);
-				waitpid(limiter, &status_limiter, 0);
-				if (WIFEXITED(status_process))
-				{
-					if (verbose)
-						printf("Process %ld terminated with exit status %d\n",
-							   (long)child, (int)WEXITSTATUS(status_process));
-					exit(WEXITSTATUS(status_process));
-				}
-				printf("Process %ld terminated abnormally\n", (long)child);
-				exit(status_process);
+				if (verbose)
+					printf("Process %ld terminated with exit status %d\n",
+						   (long)child, (int)WEXITSTATUS(command_status));
+				exit(WEXITSTATUS(command_status));
 			}
-			else
+			if (WIFSIGNALED(command_status))
 			{
-				/* limiter code */
-				if (verbose)
-					printf("Limiting process %ld\n", (long)child);
-				limit_process(child, limit, include_children);
-				exit(0);
+				printf("Process %ld terminated by signal %d\n",
+					   (long)child, (int)WTERMSIG(command_status));
+				/* as the shells report it */
+				exit(128 + WTERMSIG(command_status));
 			}
+			printf("Process %ld terminated abnormally\n", (long)child);
+			exit(EXIT_FAILURE);
 		}
 	}
 
+	/* watch the executions before searching, so that none is missed */
+	watch.type = EXEC_WATCH_NONE;
+	watch.fd = -1;
+	watch.complete = 0;
+	if (exe_ok && !lazy && open_exec_watch(&watch, exe) == 0 && verbose)
+		printf("Watching the executions of %s with %s\n", exe,
+			   watch.type == EXEC_WATCH_CONNECTOR ? "the proc connector" : "inotify");
+
 	while (!quit_flag)
 	{
 		/* look for the target process..or wait for it */
@@ -617,9 +1561,12 @@ int main(int argc, char *argv[])
 		}
 		if (lazy || quit_flag)
 			break;
-		/* wait for 2 seconds before next search */
-		sleep_timespec(&wait_time);
+		/* wait for the program to be executed, searching again every
+		2 seconds if some executions may not be notified */
+		clear_exec_events(&watch);
+		wait_exec_event(&watch, watch.complete ? NULL : &wait_time);
 	}
+	close_exec_watch(&watch);
 
 	return 0;
 }
@@ -0,0 +1,341 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+
+#include "exec_watch.h"
+#include "process_iterator.h"
+#include "util.h"
+
+/* longest list of executions kept, beyond it the processes are searched */
+#define EXEC_PIDS_MAX 1024
+
+/* forget the executions notified so far */
+void clear_exec_events(struct exec_watch *watch)
+{
+	watch->count = 0;
+	watch->lost = 0;
+}
+
+static void init_exec_events(struct exec_watch *watch)
+{
+	watch->pids = NULL;
+	watch->count = watch->size = 0;
+	watch->lost = 0;
+}
+
+static void free_exec_events(struct exec_watch *watch)
+{
+	free(watch->pids);
+	init_exec_events(watch);
+}
+
+#if defined(__linux__)
+
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+/* remember the process which executed the program */
+static void add_exec_event(struct exec_watch *watch, pid_t pid)
+{
+	if (watch->count >= EXEC_PIDS_MAX)
+	{
+		watch->lost = 1;
+		return;
+	}
+	if (watch->count == watch->size)
+	{
+		watch->size = MAX(2 * watch->size, 16);
+		watch->pids = (pid_t *)realloc(watch->pids, watch->size * sizeof(pid_t));
+		if (watch->pids == NULL)
+		{
+			exit(-1);
+		}
+	}
+	watch->pids[watch->count++] = pid;
+}
+
+/* inotify reports the opening of the executable before the exec is
+complete, the process is looked for after this delay (in ns) */
+#define INOTIFY_EXEC_DELAY 20000000
+
+/* subscribe to the exec events of the proc connector, or cancel it */
+static int send_connector_op(int fd, enum proc_cn_mcast_op op)
+{
+	union
+	{
+		struct nlmsghdr hdr;
+		char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+	} req;
+	struct cn_msg *cn;
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+	req.hdr.nlmsg_type = NLMSG_DONE;
+	cn = (struct cn_msg *)NLMSG_DATA(&req.hdr);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(enum proc_cn_mcast_op);
+	memcpy(cn->data, &op, sizeof(op));
+	return send(fd, &req, req.hdr.nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+static int open_connector(struct exec_watch *watch)
+{
+	struct sockaddr_nl addr;
+	watch->fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (watch->fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	if (bind(watch->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		send_connector_op(watch->fd, PROC_CN_MCAST_LISTEN) < 0)
+	{
+		close(watch->fd);
+		watch->fd = -1;
+		return -1;
+	}
+	watch->type = EXEC_WATCH_CONNECTOR;
+	watch->complete = 1;
+	return 0;
+}
+
+/* watch the opens in the directory of the executable, or in the
+directories of PATH if only its name is given */
+static int open_inotify(struct exec_watch *watch, const char *exe)
+{
+	int watched = 0;
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0)
+		return -1;
+	if (strchr(exe, '/') != NULL)
+	{
+		char dir[PATH_MAX + 1];
+		strncpy(dir, exe, sizeof(dir) - 1);
+		dir[sizeof(dir) - 1] = '\0';
+		watched = inotify_add_watch(watch->fd, dirname(dir), IN_OPEN) >= 0;
+	}
+	else
+	{
+		const char *path = getenv("PATH");
+		while (path != NULL && *path != '\0')
+		{
+			char dir[PATH_MAX + 1];
+			size_t len = strcspn(path, ":");
+			if (len > 0 && len < sizeof(dir))
+			{
+				memcpy(dir, path, len);
+				dir[len] = '\0';
+				if (inotify_add_watch(watch->fd, dir, IN_OPEN) >= 0)
+					watched++;
+			}
+			path += len;
+			if (*path == ':')
+				path++;
+		}
+	}
+	if (watched == 0)
+	{
+		close(watch->fd);
+		watch->fd = -1;
+		return -1;
+	}
+	watch->type = EXEC_WATCH_INOTIFY;
+	/* the program may also be run from elsewhere */
+	watch->complete = 0;
+	return 0;
+}
+
+/* drain the pending events
+return:  1 if the program may have been executed, 0 otherwise */
+static int read_events(struct exec_watch *watch)
+{
+	union
+	{
+		struct nlmsghdr hdr;
+		struct inotify_event event;
+		char buf[8192];
+	} msg;
+	int found = 0;
+	ssize_t len;
+	while ((len = read(watch->fd, &msg, sizeof(msg))) != 0)
+	{
+		if (len < 0)
+		{
+			/* events were lost, they must be looked for */
+			if (errno == ENOBUFS)
+				found = watch->lost = 1;
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			break;
+		}
+		if (watch->type == EXEC_WATCH_CONNECTOR)
+		{
+			struct nlmsghdr *hdr;
+			for (hdr = &msg.hdr; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len))
+			{
+				struct cn_msg *cn = (struct cn_msg *)NLMSG_DATA(hdr);
+				struct proc_event *ev = (struct proc_event *)cn->data;
+				if (ev->what == PROC_EVENT_EXEC &&
+					(watch->name == NULL || may_be_named(ev->event_data.exec.process_tgid, watch->name)))
+				{
+					add_exec_event(watch, ev->event_data.exec.process_tgid);
+					found = 1;
+				}
+			}
+		}
+		else
+		{
+			char *p = msg.buf;
+			while (p < msg.buf + len)
+			{
+				struct inotify_event *ev = (struct inotify_event *)p;
+				/* the process is not told */
+				if (ev->len > 0 && strcmp(ev->name, watch->name) == 0)
+					found = watch->lost = 1;
+				p += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+	}
+	return found;
+}
+
+/* start watching the executions of exe (of any program if exe is NULL),
+the proc connector is preferred to inotify
+return:  0 on success, -1 if the executions cannot be watched */
+int open_exec_watch(struct exec_watch *watch, const char *exe)
+{
+	watch->type = EXEC_WATCH_NONE;
+	watch->fd = -1;
+	watch->complete = 0;
+	init_exec_events(watch);
+	if (exe == NULL)
+	{
+		/* inotify cannot watch every program */
+		watch->name = NULL;
+		return open_connector(watch);
+	}
+	watch->name = strrchr(exe, '/') != NULL ? strrchr(exe, '/') + 1 : exe;
+	if (watch->name[0] == '\0')
+		return -1;
+	if (open_connector(watch) == 0 || open_inotify(watch, exe) == 0)
+		return 0;
+	return -1;
+}
+
+/* wait until the program may have been executed
+timeout: longest wait, NULL to wait without limits
+return:  1 if the program may have been executed
+		 0 on timeout or if interrupted by a signal */
+int wait_exec_event(struct exec_watch *watch, const struct timespec *timeout)
+{
+	struct timespec start, now;
+	struct pollfd pfd;
+	if (watch->fd < 0)
+	{
+		if (timeout != NULL)
+			sleep_timespec((struct timespec *)timeout);
+		return 0;
+	}
+	pfd.fd = watch->fd;
+	pfd.events = POLLIN;
+	get_time(&start);
+	for (;;)
+	{
+		int wait_ms = -1;
+		if (timeout != NULL)
+		{
+			get_time(&now);
+			wait_ms = (int)(timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000 -
+							timediff_in_ms(&now, &start));
+			/* the pending events are read anyway */
+			wait_ms = MAX(wait_ms, 0);
+		}
+		if (poll(&pfd, 1, wait_ms) <= 0)
+			return 0;
+		if (read_events(watch))
+		{
+			if (watch->type == EXEC_WATCH_INOTIFY)
+			{
+				struct timespec delay;
+				nsec2timespec(INOTIFY_EXEC_DELAY, &delay);
+				sleep_timespec(&delay);
+			}
+			return 1;
+		}
+	}
+}
+
+void close_exec_watch(struct exec_watch *watch)
+{
+	free_exec_events(watch);
+	if (watch->fd < 0)
+		return;
+	if (watch->type == EXEC_WATCH_CONNECTOR)
+		send_connector_op(watch->fd, PROC_CN_MCAST_IGNORE);
+	close(watch->fd);
+	watch->fd = -1;
+	watch->type = EXEC_WATCH_NONE;
+}
+
+#else
+
+int open_exec_watch(struct exec_watch *watch, const char *exe)
+{
+	(void)exe;
+	watch->type = EXEC_WATCH_NONE;
+	watch->fd = -1;
+	watch->name = NULL;
+	watch->complete = 0;
+	init_exec_events(watch);
+	return -1;
+}
+
+int wait_exec_event(struct exec_watch *watch, const struct timespec *timeout)
+{
+	(void)watch;
+	if (timeout != NULL)
+		sleep_timespec((struct timespec *)timeout);
+	return 0;
+}
+
+void close_exec_watch(struct exec_watch *watch)
+{
+	free_exec_events(watch);
+	watch->fd = -1;
+}
+
+#endif
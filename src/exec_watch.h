@@ -0,0 +1,67 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __EXEC_WATCH_H
+#define __EXEC_WATCH_H
+
+#include <time.h>
+#include <sys/types.h>
+
+/* how the executions are watched */
+enum exec_watch_type
+{
+	/* not watched, waiting only lets the time pass */
+	EXEC_WATCH_NONE,
+	/* exec events of the proc connector (needs CAP_NET_ADMIN) */
+	EXEC_WATCH_CONNECTOR,
+	/* opens of the executable file reported by inotify */
+	EXEC_WATCH_INOTIFY
+};
+
+/* notifies the executions of a program, so that a process can be
+limited as soon as it starts instead of at the next periodic search */
+struct exec_watch
+{
+	enum exec_watch_type type;
+	int fd;
+	/* basename of the watched executable, NULL for every program */
+	const char *name;
+	/* 1 if every execution of the program is notified, 0 if some
+	may be missed and the processes must still be searched periodically */
+	int complete;
+	/* processes which executed the program since clear_exec_events(),
+	when the events tell them */
+	pid_t *pids;
+	int count;
+	int size;
+	/* 1 if some executions are not in pids, the processes must be searched */
+	int lost;
+};
+
+int open_exec_watch(struct exec_watch *watch, const char *exe);
+
+int wait_exec_event(struct exec_watch *watch, const struct timespec *timeout);
+
+void clear_exec_events(struct exec_watch *watch);
+
+void close_exec_watch(struct exec_watch *watch);
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "histogram.h"
+
+#define HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+/* magnitude of the last buckets, the bounds are computed in doubles as
+2^MAX_MAGNITUDE does not fit in a 32-bit long */
+#define MAX_MAGNITUDE ((HISTOGRAM_BUCKETS - HISTOGRAM_SUB_BUCKETS) / HALF_BUCKETS)
+
+void init_histogram(struct histogram *h, const char *name, const char *unit, double scale)
+{
+	memset(h, 0, sizeof(struct histogram));
+	h->name = name;
+	h->unit = unit;
+	h->scale = scale;
+}
+
+/* v: a value rounded to an integer, not negative */
+static int bucket_of(double v)
+{
+	int magnitude = 0;
+	if (v < HISTOGRAM_SUB_BUCKETS)
+		return (int)v;
+	while (v >= ldexp(2 * HALF_BUCKETS, magnitude))
+	{
+		if (++magnitude > MAX_MAGNITUDE)
+			return HISTOGRAM_BUCKETS - 1;
+	}
+	/* v / 2^magnitude is in [HALF_BUCKETS, 2 * HALF_BUCKETS) */
+	return HISTOGRAM_SUB_BUCKETS + (magnitude - 1) * HALF_BUCKETS + (int)ldexp(v, -magnitude) - HALF_BUCKETS;
+}
+
+/* middle of the values counted in a bucket */
+static double value_of(int index)
+{
+	int magnitude;
+	double low;
+	if (index < HISTOGRAM_SUB_BUCKETS)
+		return index;
+	magnitude = (index - HISTOGRAM_SUB_BUCKETS) / HALF_BUCKETS + 1;
+	low = ldexp(HALF_BUCKETS + (index - HISTOGRAM_SUB_BUCKETS) % HALF_BUCKETS, magnitude);
+	return low + ldexp(1, magnitude - 1);
+}
+
+void record_value(struct histogram *h, double value)
+{
+	double scaled = value * h->scale;
+	if (h->count == 0 || value < h->min)
+		h->min = value;
+	if (h->count == 0 || value > h->max)
+		h->max = value;
+	h->count++;
+	if (scaled < 0)
+		h->negative[bucket_of(floor(-scaled + 0.5))]++;
+	else
+		h->positive[bucket_of(floor(scaled + 0.5))]++;
+}
+
+/* value below which falls the given percentage of the recorded values */
+double value_at_percentile(const struct histogram *h, double percentile)
+{
+	long rank, seen = 0;
+	int i;
+	double value;
+	if (h->count == 0)
+		return 0;
+	rank = (long)(percentile / 100 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank >= h->count)
+		return h->max;
+	/* the most negative values come first */
+	for (i = HISTOGRAM_BUCKETS - 1; i >= 0; i--)
+	{
+		seen += h->negative[i];
+		if (seen >= rank)
+		{
+			value = -value_of(i) / h->scale;
+			return value < h->min ? h->min : value;
+		}
+	}
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->positive[i];
+		if (seen >= rank)
+		{
+			value = value_of(i) / h->scale;
+			return value > h->max ? h->max : value;
+		}
+	}
+	return h->max;
+}
+
+void print_histogram(const struct histogram *h, FILE *stream)
+{
+	fprintf(stream, "%-16s %8ld samples    p50 %9.2f    p90 %9.2f    p99 %9.2f    max %9.2f %s\n",
+			h->name, h->count,
+			value_at_percentile(h, 50), value_at_percentile(h, 90),
+			value_at_percentile(h, 99), h->max, h->unit);
+}
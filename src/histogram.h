@@ -0,0 +1,56 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdio.h>
+
+/* values below are counted exactly, then every power of two is split
+in HISTOGRAM_SUB_BUCKETS / 2 buckets (precision about 3%) */
+#define HISTOGRAM_SUB_BUCKETS 64
+/* values up to 2^40 units, the larger ones are counted in the last bucket */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + 34 * HISTOGRAM_SUB_BUCKETS / 2)
+
+/* histogram of values with a bounded relative error, in the spirit of
+HdrHistogram, negative values are counted apart */
+struct histogram
+{
+	const char *name;
+	const char *unit;
+	/* units per value, values are recorded as integer multiples of 1/scale */
+	double scale;
+	long positive[HISTOGRAM_BUCKETS];
+	long negative[HISTOGRAM_BUCKETS];
+	long count;
+	double min;
+	double max;
+};
+
+void init_histogram(struct histogram *h, const char *name, const char *unit, double scale);
+
+void record_value(struct histogram *h, double value);
+
+double value_at_percentile(const struct histogram *h, double percentile);
+
+void print_histogram(const struct histogram *h, FILE *stream);
+
+#endif
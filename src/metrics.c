@@ -0,0 +1,250 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+#include "process_group.h"
+#include "list.h"
+#include "util.h"
+
+/* open the output described by spec, FORMAT:PATH with FORMAT json or prometheus
+the json output "-" is the standard output
+return:  0 on success, -1 on error (errno is set) */
+int open_metrics(struct metrics *metrics, const char *spec, int interval)
+{
+	const char *path = strchr(spec, ':');
+	memset(metrics, 0, sizeof(struct metrics));
+	if (path == NULL || path[1] == '\0' || interval < 1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ((size_t)(path - spec) == strlen("json") && strncmp(spec, "json", path - spec) == 0)
+		metrics->format = METRICS_JSON;
+	else if ((size_t)(path - spec) == strlen("prometheus") && strncmp(spec, "prometheus", path - spec) == 0)
+		metrics->format = METRICS_PROMETHEUS;
+	else
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	path++;
+	if (metrics->format == METRICS_JSON)
+	{
+		if (strcmp(path, "-") == 0)
+			metrics->out = stdout;
+		else if ((metrics->out = fopen_cloexec(path, "a")) == NULL)
+			return -1;
+	}
+	metrics->path = strdup(path);
+	if (metrics->path == NULL)
+	{
+		exit(-1);
+	}
+	metrics->owner = getpid();
+	metrics->interval = interval;
+	return 0;
+}
+
+static int compare_pid(const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* compare the members with those of the last record */
+static void count_changes(struct metrics *metrics, struct process_group *pgroup, int *added, int *removed)
+{
+	struct list_node *node;
+	pid_t *pids;
+	int i = 0, j = 0, count = 0;
+
+	pids = (pid_t *)malloc(pgroup->proclist->count * sizeof(pid_t) + 1);
+	if (pids == NULL)
+	{
+		exit(-1);
+	}
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+		pids[count++] = ((const struct process *)node->data)->pid;
+	qsort(pids, count, sizeof(pid_t), compare_pid);
+	*added = *removed = 0;
+	while (i < count || j < metrics->count)
+	{
+		if (j == metrics->count || (i < count && pids[i] < metrics->pids[j]))
+		{
+			(*added)++;
+			i++;
+		}
+		else if (i == count || metrics->pids[j] < pids[i])
+		{
+			(*removed)++;
+			j++;
+		}
+		else
+		{
+			i++;
+			j++;
+		}
+	}
+	free(metrics->pids);
+	metrics->pids = pids;
+	metrics->count = count;
+}
+
+static void write_json(struct metrics *metrics, struct process_group *pgroup, double now,
+					   double limit, double pcpu, double workingrate, int added, int removed)
+{
+	struct list_node *node;
+	FILE *out = metrics->out;
+	fprintf(out, "{\"time\":%.3f,\"limit\":%.4f,\"cpu\":%.4f,\"duty_cycle\":%.4f,"
+				 "\"scan_ms\":%.3f,\"signals\":%lu,\"members_added\":%d,\"members_removed\":%d,"
+				 "\"members\":[",
+			now, limit, pcpu, workingrate,
+			metrics->scans > 0 ? metrics->scan_time / metrics->scans : 0,
+			metrics->signals, added, removed);
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		fprintf(out, "%s{\"pid\":%ld,\"cpu\":", node == pgroup->proclist->first ? "" : ",", (long)p->pid);
+		if (p->cpu_usage < 0)
+			fprintf(out, "null}");
+		else
+			fprintf(out, "%.4f}", p->cpu_usage);
+	}
+	fprintf(out, "]}\n");
+	fflush(out);
+}
+
+#define prom_metric(out, name, type, help)                  \
+	fprintf(out, "# HELP cpulimit_" name " " help "\n"      \
+				 "# TYPE cpulimit_" name " " type "\n")
+
+/* write the whole file aside, then move it in place, so that readers
+never see a partial file */
+static int write_prometheus(struct metrics *metrics, struct process_group *pgroup, double now,
+							double limit, double pcpu, double workingrate)
+{
+	struct list_node *node;
+	char *tmp_path;
+	FILE *out;
+	long owner = (long)metrics->owner;
+	int ret;
+
+	tmp_path = (char *)malloc(strlen(metrics->path) + sizeof(".tmp"));
+	if (tmp_path == NULL)
+	{
+		exit(-1);
+	}
+	sprintf(tmp_path, "%s.tmp", metrics->path);
+	if ((out = fopen_cloexec(tmp_path, "w")) == NULL)
+	{
+		free(tmp_path);
+		return -1;
+	}
+	prom_metric(out, "limit_ratio", "gauge", "Cpu allowed (1 is one cpu).");
+	fprintf(out, "cpulimit_limit_ratio{cpulimit=\"%ld\"} %.4f\n", owner, limit);
+	prom_metric(out, "cpu_usage_ratio", "gauge", "Cpu used by the limited processes (1 is one cpu).");
+	fprintf(out, "cpulimit_cpu_usage_ratio{cpulimit=\"%ld\"} %.4f\n", owner, pcpu);
+	prom_metric(out, "duty_cycle_ratio", "gauge", "Fraction of the time the processes are let run.");
+	fprintf(out, "cpulimit_duty_cycle_ratio{cpulimit=\"%ld\"} %.4f\n", owner, workingrate);
+	prom_metric(out, "scan_seconds", "gauge", "Average time spent updating the process group.");
+	fprintf(out, "cpulimit_scan_seconds{cpulimit=\"%ld\"} %.6f\n", owner,
+			metrics->scans > 0 ? metrics->scan_time / metrics->scans / 1000 : 0);
+	prom_metric(out, "signals_total", "counter", "Signals sent to the limited processes.");
+	fprintf(out, "cpulimit_signals_total{cpulimit=\"%ld\"} %lu\n", owner, metrics->total_signals);
+	prom_metric(out, "members", "gauge", "Processes in the group.");
+	fprintf(out, "cpulimit_members{cpulimit=\"%ld\"} %d\n", owner, pgroup->proclist->count);
+	prom_metric(out, "members_added_total", "counter", "Processes which joined the group.");
+	fprintf(out, "cpulimit_members_added_total{cpulimit=\"%ld\"} %lu\n", owner, metrics->total_added);
+	prom_metric(out, "members_removed_total", "counter", "Processes which left the group.");
+	fprintf(out, "cpulimit_members_removed_total{cpulimit=\"%ld\"} %lu\n", owner, metrics->total_removed);
+	prom_metric(out, "member_cpu_usage_ratio", "gauge", "Cpu used by each process of the group.");
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		if (p->cpu_usage >= 0)
+			fprintf(out, "cpulimit_member_cpu_usage_ratio{cpulimit=\"%ld\",pid=\"%ld\"} %.4f\n",
+					owner, (long)p->pid, p->cpu_usage);
+	}
+	prom_metric(out, "last_update_timestamp_seconds", "gauge", "Time of the last update.");
+	fprintf(out, "cpulimit_last_update_timestamp_seconds{cpulimit=\"%ld\"} %.3f\n", owner, now);
+
+	ret = ferror(out) | fclose(out);
+	if (ret == 0)
+		ret = rename(tmp_path, metrics->path);
+	else
+		unlink(tmp_path);
+	free(tmp_path);
+	return ret;
+}
+
+/* to be called once per cycle, writes a record every interval cycles
+limit, pcpu: cpu allowed and used by the group (range 0-NCPU)
+workingrate: fraction of the time the group is let run */
+void record_metrics(struct metrics *metrics, struct process_group *pgroup,
+					double limit, double pcpu, double workingrate)
+{
+	struct timeval tv;
+	int added, removed;
+	if (metrics->path == NULL || ++metrics->cycles < metrics->interval)
+		return;
+	gettimeofday(&tv, NULL);
+	count_changes(metrics, pgroup, &added, &removed);
+	metrics->total_signals += metrics->signals;
+	metrics->total_added += added;
+	metrics->total_removed += removed;
+	if (metrics->format == METRICS_JSON)
+		write_json(metrics, pgroup, tv.tv_sec + tv.tv_usec / 1e6, limit, pcpu, workingrate, added, removed);
+	else
+		write_prometheus(metrics, pgroup, tv.tv_sec + tv.tv_usec / 1e6, limit, pcpu, workingrate);
+	metrics->cycles = 0;
+	metrics->scan_time = 0;
+	metrics->scans = 0;
+	metrics->signals = 0;
+}
+
+void close_metrics(struct metrics *metrics)
+{
+	if (metrics->path == NULL)
+		return;
+	if (metrics->out != NULL && metrics->out != stdout)
+		fclose(metrics->out);
+	metrics->out = NULL;
+	/* stale values must not be scraped, but forked children must not
+	remove the file of their parent */
+	if (metrics->format == METRICS_PROMETHEUS && metrics->owner == getpid())
+		unlink(metrics->path);
+	free(metrics->path);
+	metrics->path = NULL;
+	free(metrics->pids);
+	metrics->pids = NULL;
+	metrics->count = 0;
+}
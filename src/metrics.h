@@ -0,0 +1,72 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "process_group.h"
+
+enum metrics_format
+{
+	/* one json object per line, appended */
+	METRICS_JSON,
+	/* prometheus text format, replaced at every record */
+	METRICS_PROMETHEUS
+};
+
+/* statistics of the limiter written for other programs */
+struct metrics
+{
+	enum metrics_format format;
+	/* output file, NULL if disabled */
+	char *path;
+	/* json output */
+	FILE *out;
+	/* process which created the output */
+	pid_t owner;
+	/* cycles between two records */
+	int interval;
+	int cycles;
+	/* time spent updating the process group (in ms), and updates */
+	double scan_time;
+	int scans;
+	/* signals sent to the processes */
+	unsigned long signals;
+	/* totals since the start, for the prometheus counters */
+	unsigned long total_signals;
+	unsigned long total_added;
+	unsigned long total_removed;
+	/* members at the last record (sorted) */
+	pid_t *pids;
+	int count;
+};
+
+int open_metrics(struct metrics *metrics, const char *spec, int interval);
+
+void record_metrics(struct metrics *metrics, struct process_group *pgroup,
+					double limit, double pcpu, double workingrate);
+
+void close_metrics(struct metrics *metrics);
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pressure.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#if defined(__linux__)
+
+/* read the total stall time (in us) of the "some" line of /proc/pressure/cpu */
+static int read_psi(double *stall)
+{
+	FILE *fd;
+	int ret = -1;
+	if ((fd = fopen("/proc/pressure/cpu", "r")) == NULL)
+		return -1;
+	if (fscanf(fd, "some avg10=%*f avg60=%*f avg300=%*f total=%lf", stall) == 1)
+		ret = 0;
+	fclose(fd);
+	return ret;
+}
+
+/* read the busy and total cpu time (in ticks) from the first line of /proc/stat */
+static int read_stat(double *busy, double *total)
+{
+	FILE *fd;
+	double user, nice, system, idle, iowait, irq, softirq, steal;
+	int ret = -1;
+	if ((fd = fopen("/proc/stat", "r")) == NULL)
+		return -1;
+	if (fscanf(fd, "cpu %lf %lf %lf %lf %lf %lf %lf %lf",
+			   &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 8)
+	{
+		*busy = user + nice + system + irq + softirq + steal;
+		*total = *busy + idle + iowait;
+		ret = 0;
+	}
+	fclose(fd);
+	return ret;
+}
+
+/* read the time a process spent waiting for a cpu (in ms), the second
+field of /proc/PID/schedstat (in ns)
+return:  0 on success, -1 on error */
+int read_run_delay(pid_t pid, double *delay)
+{
+	char path[64];
+	FILE *fd;
+	double ns;
+	int ret = -1;
+	sprintf(path, "/proc/%ld/schedstat", (long)pid);
+	if ((fd = fopen(path, "r")) == NULL)
+		return -1;
+	if (fscanf(fd, "%*f %lf", &ns) == 1)
+	{
+		*delay = ns / 1e6;
+		ret = 0;
+	}
+	fclose(fd);
+	return ret;
+}
+
+/* prepare to measure the cpu pressure, PSI is preferred to /proc/stat
+return:  0 on success, -1 if the pressure cannot be measured */
+int init_cpu_pressure(struct cpu_pressure *pressure)
+{
+	pressure->level = 0;
+	pressure->hold = pressure->hold_length = PRESSURE_HOLD;
+	pressure->relaxed = 0;
+	pressure->use_psi = read_psi(&pressure->last_counter) == 0;
+	if (!pressure->use_psi &&
+		read_stat(&pressure->last_counter, &pressure->last_total) != 0)
+		return -1;
+	return clock_gettime(CLOCK_MONOTONIC, &pressure->last_time);
+}
+
+/* measure the cpu pressure since the previous call
+own: fraction of the cpu time of the system used by the limited processes
+	 in the meantime, it tells them apart from competitors in /proc/stat
+own_wait: time (in ms) the limited processes waited for a cpu in the
+	 meantime, it tells them apart from competitors in PSI
+return:  1 if processes are competing for the cpu
+		 0 if there is cpu to spare
+		 -1 on error */
+int check_cpu_pressure(struct cpu_pressure *pressure, double own, double own_wait)
+{
+	if (pressure->use_psi)
+	{
+		struct timespec now;
+		double stall, dt;
+		if (read_psi(&stall) != 0 || clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+			return -1;
+		dt = (now.tv_sec - pressure->last_time.tv_sec) * 1e6 +
+			 (now.tv_nsec - pressure->last_time.tv_nsec) / 1e3;
+		if (dt <= 0)
+			return pressure->level >= PSI_THRESHOLD;
+		/* the limited processes waiting for each other are no pressure,
+		their waits may overlap: the level is rather underestimated */
+		pressure->level = MAX(stall - pressure->last_counter - own_wait * 1000, 0) / dt;
+		pressure->last_counter = stall;
+		pressure->last_time = now;
+		return pressure->level >= PSI_THRESHOLD;
+	}
+	else
+	{
+		double busy, total;
+		if (read_stat(&busy, &total) != 0)
+			return -1;
+		if (total > pressure->last_total)
+		{
+			pressure->level = (busy - pressure->last_counter) / (total - pressure->last_total);
+			pressure->last_counter = busy;
+			pressure->last_total = total;
+		}
+		/* saturated, and not only by the limited processes */
+		return pressure->level > 1 - IDLE_THRESHOLD && pressure->level - own > IDLE_THRESHOLD;
+	}
+}
+
+#else
+
+int init_cpu_pressure(struct cpu_pressure *pressure)
+{
+	pressure->use_psi = 0;
+	pressure->level = 0;
+	pressure->hold = pressure->hold_length = PRESSURE_HOLD;
+	pressure->relaxed = 0;
+	return -1;
+}
+
+int read_run_delay(pid_t pid, double *delay)
+{
+	(void)pid;
+	(void)delay;
+	return -1;
+}
+
+int check_cpu_pressure(struct cpu_pressure *pressure, double own, double own_wait)
+{
+	(void)pressure;
+	(void)own;
+	(void)own_wait;
+	return -1;
+}
+
+#endif
+
+/* decide whether the limit must be enforced, to be called once per slot
+the limit stays enforced for a while after the pressure is gone, and for
+longer every time the pressure comes back right after relaxing it
+return:  1 if the limit must be enforced, 0 otherwise */
+int enforce_under_pressure(struct cpu_pressure *pressure, double own, double own_wait)
+{
+	/* on errors the limit is enforced */
+	if (check_cpu_pressure(pressure, own, own_wait) != 0)
+	{
+		if (pressure->hold == 0)
+		{
+			if (pressure->relaxed < pressure->hold_length)
+				pressure->hold_length = MIN(2 * pressure->hold_length, PRESSURE_HOLD_MAX);
+			else
+				pressure->hold_length = PRESSURE_HOLD;
+		}
+		pressure->hold = pressure->hold_length;
+		pressure->relaxed = 0;
+	}
+	else if (pressure->hold > 0)
+	{
+		pressure->hold--;
+	}
+	else
+	{
+		pressure->relaxed++;
+	}
+	return pressure->hold > 0;
+}
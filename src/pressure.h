@@ -0,0 +1,69 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __PRESSURE_H
+#define __PRESSURE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/* fraction of the time some task waited for the cpu (PSI)
+above which the system is considered under pressure */
+#define PSI_THRESHOLD 0.1
+/* fraction of the cpu time spent idle (/proc/stat)
+below which the system is considered under pressure */
+#define IDLE_THRESHOLD 0.05
+
+/* checks in which the limit stays enforced after the last sign of pressure */
+#define PRESSURE_HOLD 10
+/* longest hold, reached when the pressure keeps coming back as soon as the
+limit is relaxed (the limited processes are the ones causing it) */
+#define PRESSURE_HOLD_MAX 80
+
+struct cpu_pressure
+{
+	/* 1 if the pressure stall information is available */
+	int use_psi;
+	/* last reading of the counter: total stall time (in us) with PSI,
+	busy cpu time (in ticks) with /proc/stat */
+	double last_counter;
+	/* total cpu time (in ticks) of the last reading of /proc/stat */
+	double last_total;
+	struct timespec last_time;
+	/* last measure: stall ratio with PSI, busy ratio with /proc/stat */
+	double level;
+	/* checks left before relaxing the limit */
+	int hold;
+	/* current length of the hold */
+	int hold_length;
+	/* checks since the limit was relaxed */
+	int relaxed;
+};
+
+int init_cpu_pressure(struct cpu_pressure *pressure);
+
+int read_run_delay(pid_t pid, double *delay);
+
+int check_cpu_pressure(struct cpu_pressure *pressure, double own, double own_wait);
+
+int enforce_under_pressure(struct cpu_pressure *pressure, double own, double own_wait);
+
+#endif
@@ -34,30 +34,7 @@
 #include "process_iterator.h"
 #include "process_group.h"
 #include "list.h"
-
-#ifndef get_time
-#if _POSIX_TIMERS > 0
-#if defined(CLOCK_TAI)
-#define get_time(ts) clock_gettime(CLOCK_TAI, (ts))
-#elif defined(CLOCK_MONOTONIC)
-#define get_time(ts) clock_gettime(CLOCK_MONOTONIC, (ts))
-#endif
-#endif
-#endif
-#ifndef get_time
-static int __get_time(struct timespec *ts)
-{
-	struct timeval tv;
-	if (gettimeofday(&tv, NULL))
-	{
-		return -1;
-	}
-	ts->tv_sec = tv.tv_sec;
-	ts->tv_nsec = tv.tv_usec * 1000L;
-	return 0;
-}
-#define get_time(ts) __get_time(ts)
-#endif
+#include "util.h"
 
 #ifndef basename
 static char *__basename(char *path)
@@ -77,6 +54,20 @@ pid_t find_process_by_pid(pid_t pid)
 	return (kill(pid, 0) == 0) ? pid : -pid;
 }
 
+/* check if the command of a process has the given basename */
+static int is_named(const struct process *proc, const char *process_basename)
+{
+	static char command_basename[PATH_MAX + 1];
+	int cmp_len;
+	strncpy(command_basename, basename((char *)proc->command),
+			sizeof(command_basename) - 1);
+	command_basename[sizeof(command_basename) - 1] = '\0';
+	cmp_len = proc->max_cmd_len -
+			  (strlen(proc->command) - strlen(command_basename));
+	return cmp_len > 0 && command_basename[0] != '\0' &&
+		   strncmp(command_basename, process_basename, cmp_len) == 0;
+}
+
 /* look for a process with a given name
 process: the name of the wanted process. it can be an absolute path name to the executable file
 		or just the file name
@@ -93,24 +84,18 @@ pid_t find_process_by_name(char *process_name)
 	struct process proc;
 	struct process_filter filter;
 	static char process_basename[PATH_MAX + 1];
-	static char command_basename[PATH_MAX + 1];
 	strncpy(process_basename, basename(process_name),
 			sizeof(process_basename) - 1);
 	process_basename[sizeof(process_basename) - 1] = '\0';
 	filter.pid = 0;
 	filter.include_children = 0;
+	/* most processes are told apart by their name alone */
+	filter.comm = process_basename;
 	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &proc) != -1)
 	{
-		int cmp_len;
-		strncpy(command_basename, basename(proc.command),
-				sizeof(command_basename) - 1);
-		command_basename[sizeof(command_basename) - 1] = '\0';
-		cmp_len = proc.max_cmd_len -
-				  (strlen(proc.command) - strlen(command_basename));
 		/* process found */
-		if (cmp_len > 0 && command_basename[0] != '\0' &&
-			strncmp(command_basename, process_basename, cmp_len) == 0)
+		if (is_named(&proc, process_basename))
 		{
 			if (pid < 0)
 			{
@@ -143,11 +128,12 @@ pid_t find_process_by_name(char *process_name)
 	}
 }
 
+/* build a group and search its members
+target_pid: its first target, 0 for all the processes, negative for none */
 int init_process_group(struct process_group *pgroup, pid_t target_pid, int include_children)
 {
 	/* hashtable initialization */
 	memset(&pgroup->proctable, 0, sizeof(pgroup->proctable));
-	pgroup->target_pid = target_pid;
 	pgroup->include_children = include_children;
 	pgroup->proclist = (struct list *)malloc(sizeof(struct list));
 	if (pgroup->proclist == NULL)
@@ -155,6 +141,47 @@ int init_process_group(struct process_group *pgroup, pid_t target_pid, int inclu
 		exit(-1);
 	}
 	init_list(pgroup->proclist, sizeof(pid_t));
+	pgroup->targets = (struct list *)malloc(sizeof(struct list));
+	if (pgroup->targets == NULL)
+	{
+		exit(-1);
+	}
+	init_list(pgroup->targets, sizeof(pid_t));
+	if (target_pid >= 0)
+		add_target(pgroup, target_pid);
+	pgroup->name = NULL;
+	pgroup->named = (struct list *)malloc(sizeof(struct list));
+	if (pgroup->named == NULL)
+	{
+		exit(-1);
+	}
+	init_list(pgroup->named, sizeof(pid_t));
+	pgroup->leaves = (struct list *)malloc(sizeof(struct list));
+	if (pgroup->leaves == NULL)
+	{
+		exit(-1);
+	}
+	init_list(pgroup->leaves, sizeof(pid_t));
+	pgroup->reaper = 0;
+	pgroup->pgids = (struct list *)malloc(sizeof(struct list));
+	if (pgroup->pgids == NULL)
+	{
+		exit(-1);
+	}
+	init_list(pgroup->pgids, sizeof(pid_t));
+	pgroup->mixed_pgids = (struct list *)malloc(sizeof(struct list));
+	if (pgroup->mixed_pgids == NULL)
+	{
+		exit(-1);
+	}
+	init_list(pgroup->mixed_pgids, sizeof(pid_t));
+	pgroup->pgids_stale = 0;
+	init_stat_sampler(&pgroup->sampler);
+	pgroup->sample_cputime = 0;
+	pgroup->sample_interval = 0;
+	pgroup->generation = 0;
+	pgroup->targets_changed = 1;
+	pgroup->last_pid = -1;
 	if (get_time(&pgroup->last_update))
 	{
 		exit(-1);
@@ -180,102 +207,714 @@ int close_process_group(struct process_group *pgroup)
 	clear_list(pgroup->proclist);
 	free(pgroup->proclist);
 	pgroup->proclist = NULL;
+	destroy_list(pgroup->targets);
+	free(pgroup->targets);
+	pgroup->targets = NULL;
+	destroy_list(pgroup->named);
+	free(pgroup->named);
+	pgroup->named = NULL;
+	destroy_list(pgroup->leaves);
+	free(pgroup->leaves);
+	pgroup->leaves = NULL;
+	free(pgroup->name);
+	pgroup->name = NULL;
+	destroy_list(pgroup->pgids);
+	free(pgroup->pgids);
+	pgroup->pgids = NULL;
+	destroy_list(pgroup->mixed_pgids);
+	free(pgroup->mixed_pgids);
+	pgroup->mixed_pgids = NULL;
+	close_stat_sampler(&pgroup->sampler);
 	return 0;
 }
 
-/* returns t1-t2 in millisecond */
-/* static inline double timediff_in_ms(const struct timespec *t1, const struct timespec *t2) */
-#define timediff_in_ms(t1, t2) \
-	(((t1)->tv_sec - (t2)->tv_sec) * 1e3 + ((t1)->tv_nsec - (t2)->tv_nsec) / 1e6)
+/* make p a member of the group, its cpu time is accounted from now on
+proc: the process as read by the iterator */
+static void init_member(struct process_group *pgroup, struct process *p, const struct process *proc)
+{
+	memcpy(p, proc, sizeof(struct process));
+	p->cpu_usage = -1;
+	p->used = -1;
+	p->run_delay = -1;
+	p->start_cputime = proc->cputime;
+	p->children_debt = 0;
+	p->generation = pgroup->generation;
+	add_elem(pgroup->proclist, p);
+}
 
-/* parameter in range 0-1 */
-#define ALPHA 0.08
-#define MIN_DT 20
+/* add a process to the group, its cpu usage is unknown until the next sample
+return:  the descriptor of the member */
+struct process *add_process(struct process_group *pgroup, const struct process *proc)
+{
+	int hashkey = pid_hashfn(proc->pid);
+	struct process *new_process = (struct process *)malloc(sizeof(struct process));
+	if (new_process == NULL)
+	{
+		exit(-1);
+	}
+	init_member(pgroup, new_process, proc);
+	if (pgroup->proctable[hashkey] == NULL)
+	{
+		/* empty bucket */
+		pgroup->proctable[hashkey] = (struct list *)malloc(sizeof(struct list));
+		if (pgroup->proctable[hashkey] == NULL)
+		{
+			exit(-1);
+		}
+		init_list(pgroup->proctable[hashkey], sizeof(pid_t));
+	}
+	add_elem(pgroup->proctable[hashkey], new_process);
+	return new_process;
+}
+
+/* account the cpu time (in ms) used by a member in the last dt ms
+its usage is an exponentially weighted moving average of the samples
+the cpu time of the children it waited for counts, unless it was
+accounted while they were members */
+void update_cpu_usage(struct process_group *pgroup, struct process *p, double cputime, double dt)
+{
+	double used = cputime - p->cputime;
+	double paid = MIN(p->children_debt, MAX(used, 0));
+	double sample;
+	p->children_debt -= paid;
+	used -= paid;
+	p->used = used;
+	sample = used / dt;
+	pgroup->sample_cputime += used;
+	if (p->cpu_usage < 0)
+	{
+		/* initialization */
+		p->cpu_usage = sample;
+	}
+	else
+	{
+		/* usage adjustment */
+		p->cpu_usage = (1.0 - ALPHA) * p->cpu_usage + ALPHA * sample;
+	}
+	p->cputime = cputime;
+}
+
+/* number of members in a process group */
+struct pgid_count
+{
+	pid_t pgid;
+	int members;
+};
+
+static void add_pgid(struct list *pgids, pid_t pgid)
+{
+	pid_t *elem = (pid_t *)malloc(sizeof(pid_t));
+	if (elem == NULL)
+	{
+		exit(-1);
+	}
+	*elem = pgid;
+	add_elem(pgids, elem);
+}
 
-void update_process_group(struct process_group *pgroup)
+/* look for the process group ids shared by several members and owned by
+the group alone
+only the pgids never seen before cost a scan of all the processes of the
+system, a whole pgid stays so while its members which leave the group are
+gone (see account_gone_members), and only whole subtrees qualify, their
+new processes join the group anyway */
+static void update_pgids(struct process_group *pgroup)
 {
 	struct process_iterator it;
 	struct process tmp_process;
 	struct process_filter filter;
-	struct timespec now;
-	double dt;
-	if (get_time(&now))
+	struct list_node *node;
+	struct list_node *next;
+	struct list counts;
+	struct list candidates;
+
+	pgroup->pgids_stale = 0;
+	if (!pgroup->include_children || pgroup->leaves->count > 0)
 	{
-		exit(1);
+		destroy_list(pgroup->pgids);
+		init_list(pgroup->pgids, sizeof(pid_t));
+		return;
 	}
-	/* time elapsed from previous sample (in ms) */
-	dt = timediff_in_ms(&now, &pgroup->last_update);
-	filter.pid = pgroup->target_pid;
-	filter.include_children = pgroup->include_children;
+	init_list(&counts, sizeof(pid_t));
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		struct pgid_count *count = (struct pgid_count *)locate_elem(&counts, &p->pgid);
+		if (count == NULL)
+		{
+			count = (struct pgid_count *)malloc(sizeof(struct pgid_count));
+			if (count == NULL)
+			{
+				exit(-1);
+			}
+			count->pgid = p->pgid;
+			count->members = 0;
+			add_elem(&counts, count);
+		}
+		count->members++;
+	}
+	/* a pgid left without members may be given to another process, and
+	a single kill() does not save anything */
+	for (node = pgroup->pgids->first; node != NULL; node = next)
+	{
+		const struct pgid_count *count = (const struct pgid_count *)locate_elem(&counts, node->data);
+		next = node->next;
+		if (count == NULL || count->members < 2)
+			destroy_node(pgroup->pgids, node);
+	}
+	init_list(&candidates, sizeof(pid_t));
+	for (node = counts.first; node != NULL; node = node->next)
+	{
+		const struct pgid_count *count = (const struct pgid_count *)node->data;
+		/* the limiter must not stop itself */
+		if (count->pgid <= 1 || count->pgid == getpgrp() || count->members < 2 ||
+			locate_elem(pgroup->pgids, &count->pgid) != NULL ||
+			locate_elem(pgroup->mixed_pgids, &count->pgid) != NULL)
+			continue;
+		add_pgid(&candidates, count->pgid);
+	}
+	destroy_list(&counts);
+	if (candidates.count == 0)
+		return;
+
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = NULL;
 	init_process_iterator(&it, &filter);
-	clear_list(pgroup->proclist);
-	init_list(pgroup->proclist, sizeof(pid_t));
+	while (get_next_process(&it, &tmp_process) != -1)
+	{
+		struct process *p;
+		if ((node = locate_node(&candidates, &tmp_process.pgid)) == NULL)
+			continue;
+		p = locate_process(pgroup, tmp_process.pid);
+		if (p == NULL || p->generation != pgroup->generation)
+		{
+			/* somebody else would be signalled too */
+			add_pgid(pgroup->mixed_pgids, tmp_process.pgid);
+			destroy_node(&candidates, node);
+		}
+	}
+	close_process_iterator(&it);
+	for (node = candidates.first; node != NULL; node = node->next)
+		add_pgid(pgroup->pgids, *(pid_t *)node->data);
+	destroy_list(&candidates);
+}
 
+/* make the running instances of the program pgroup->name targets, and
+remove the targets of the instances which are gone */
+static void update_named_targets(struct process_group *pgroup)
+{
+	struct process_iterator it;
+	struct process tmp_process;
+	struct process_filter filter;
+	struct list_node *node;
+	struct list *found = (struct list *)malloc(sizeof(struct list));
+	if (found == NULL)
+	{
+		exit(-1);
+	}
+	init_list(found, sizeof(pid_t));
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = pgroup->name;
+	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &tmp_process) != -1)
 	{
-		int hashkey = pid_hashfn(tmp_process.pid);
-		if (pgroup->proctable[hashkey] == NULL)
+		pid_t *pid;
+		/* cpulimit itself is never limited */
+		if (tmp_process.pid == getpid() || !is_named(&tmp_process, pgroup->name))
+			continue;
+		pid = (pid_t *)malloc(sizeof(pid_t));
+		if (pid == NULL)
+		{
+			exit(-1);
+		}
+		*pid = tmp_process.pid;
+		add_elem(found, pid);
+	}
+	close_process_iterator(&it);
+
+	node = pgroup->named->first;
+	while (node != NULL)
+	{
+		struct list_node *next_node = node->next;
+		if (locate_elem(found, node->data) == NULL)
 		{
-			/* empty bucket */
-			struct process *new_process = (struct process *)malloc(sizeof(struct process));
-			if (new_process == NULL)
+			/* the instance is gone */
+			remove_target(pgroup, *(pid_t *)node->data);
+			destroy_node(pgroup->named, node);
+		}
+		node = next_node;
+	}
+	for (node = found->first; node != NULL; node = node->next)
+	{
+		/* the targets added otherwise are left alone */
+		if (locate_elem(pgroup->named, node->data) == NULL &&
+			add_target(pgroup, *(pid_t *)node->data) == 0)
+		{
+			pid_t *pid = (pid_t *)malloc(sizeof(pid_t));
+			if (pid == NULL)
 			{
 				exit(-1);
 			}
-			pgroup->proctable[hashkey] = (struct list *)malloc(sizeof(struct list));
-			if (pgroup->proctable[hashkey] == NULL)
+			*pid = *(pid_t *)node->data;
+			add_elem(pgroup->named, pid);
+		}
+	}
+	destroy_list(found);
+	free(found);
+}
+
+/* make all the running instances of a program targets of the group, the
+new instances join the group at every update and the ones gone leave it
+name: the name of the program, an absolute path name or just the file name */
+void set_target_name(struct process_group *pgroup, const char *name)
+{
+	char *path = (char *)malloc(strlen(name) + 1);
+	char *base;
+	if (path == NULL)
+	{
+		exit(-1);
+	}
+	strcpy(path, name);
+	base = basename(path);
+	free(pgroup->name);
+	pgroup->name = (char *)malloc(strlen(base) + 1);
+	if (pgroup->name == NULL)
+	{
+		exit(-1);
+	}
+	strcpy(pgroup->name, base);
+	free(path);
+	pgroup->targets_changed = 1;
+}
+
+/* read a single process
+return:  0 on success, -1 otherwise, errno tells why */
+static int read_process(pid_t pid, struct process *p)
+{
+	struct process_iterator it;
+	struct process_filter filter;
+	int ret, error;
+	filter.pid = pid;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	if (init_process_iterator(&it, &filter) != 0)
+		return -1;
+	ret = get_next_process(&it, p) == 0 ? 0 : -1;
+	error = errno;
+	close_process_iterator(&it);
+	errno = error;
+	return ret;
+}
+
+/* a process and its parent, out of a scan of all the processes */
+struct family
+{
+	pid_t pid;
+	pid_t ppid;
+};
+
+static int compare_ppid(const void *a, const void *b)
+{
+	pid_t x = ((const struct family *)a)->ppid, y = ((const struct family *)b)->ppid;
+	return x < y ? -1 : x > y;
+}
+
+/* list the parent of every process, sorted by parent, for the kernels
+which do not list the children of the processes
+count: set to the number of processes */
+static struct family *scan_families(int *count)
+{
+	struct process_iterator it;
+	struct process tmp_process;
+	struct process_filter filter;
+	struct family *families = NULL;
+	int size = 0;
+	*count = 0;
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	init_process_iterator(&it, &filter);
+	while (get_next_process(&it, &tmp_process) != -1)
+	{
+		if (*count == size)
+		{
+			size = MAX(2 * size, 256);
+			families = (struct family *)realloc(families, size * sizeof(struct family));
+			if (families == NULL)
 			{
 				exit(-1);
 			}
-			tmp_process.cpu_usage = -1;
-			memcpy(new_process, &tmp_process, sizeof(struct process));
-			init_list(pgroup->proctable[hashkey], sizeof(pid_t));
-			add_elem(pgroup->proctable[hashkey], new_process);
-			add_elem(pgroup->proclist, new_process);
 		}
+		families[*count].pid = tmp_process.pid;
+		families[*count].ppid = tmp_process.ppid;
+		(*count)++;
+	}
+	close_process_iterator(&it);
+	qsort(families, *count, sizeof(struct family), compare_ppid);
+	return families;
+}
+
+/* append the children of pid, found in the families, to children */
+static void find_children(const struct family *families, int count, pid_t pid, struct list *children)
+{
+	int low = 0, high = count;
+	/* the first process whose parent is not before pid */
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (families[middle].ppid < pid)
+			low = middle + 1;
 		else
+			high = middle;
+	}
+	for (; low < count && families[low].ppid == pid; low++)
+	{
+		pid_t *child = (pid_t *)malloc(sizeof(pid_t));
+		if (child == NULL)
 		{
-			/* existing bucket */
-			struct process *p = (struct process *)locate_elem(pgroup->proctable[hashkey], &tmp_process);
-			if (p == NULL)
-			{
-				/* process is new. add it */
-				struct process *new_process = (struct process *)malloc(sizeof(struct process));
-				if (new_process == NULL)
-				{
-					exit(-1);
-				}
-				tmp_process.cpu_usage = -1;
-				memcpy(new_process, &tmp_process, sizeof(struct process));
-				add_elem(pgroup->proctable[hashkey], new_process);
-				add_elem(pgroup->proclist, new_process);
-			}
-			else
+			exit(-1);
+		}
+		*child = families[low].pid;
+		add_elem(children, child);
+	}
+}
+
+/* the members sampled by an update, with their cpu time read on the way */
+struct samples
+{
+	struct process **procs;
+	double *cputimes;
+	int *with_children;
+	int count;
+	int size;
+};
+
+/* make a process read by an update a member of the group
+with_children: its time includes the one of the children it waited for
+return:  the member, NULL if it cannot be one or if it joined already */
+static struct process *join_group(struct process_group *pgroup, struct process *tmp_process,
+								  int with_children, struct samples *samples, int *changed)
+{
+	struct process *p;
+	/* the children waited for by the members are members too,
+	if they left before being seen their time is still accounted */
+	if (with_children)
+		tmp_process->cputime += tmp_process->children_cputime;
+	tmp_process->with_children = with_children;
+	if (pgroup->reaper > 0 &&
+		(tmp_process->pid == pgroup->reaper || tmp_process->pid == getpid()))
+		return NULL;
+	p = locate_process(pgroup, tmp_process->pid);
+	/* subtrees of different targets may overlap, the members which
+	joined in this update are marked with the next generation */
+	if (p != NULL && p->generation == pgroup->generation + 1)
+		return NULL;
+	if (p == NULL)
+	{
+		/* process is new. add it */
+		p = add_process(pgroup, tmp_process);
+		*changed = 1;
+	}
+	else if (p->generation != pgroup->generation)
+	{
+		/* it left the group and came back, the cpu time used
+		meanwhile is not accounted */
+		init_member(pgroup, p, tmp_process);
+		*changed = 1;
+	}
+	else
+	{
+		/* process exists */
+		add_elem(pgroup->proclist, p);
+		if (p->with_children != tmp_process->with_children)
+		{
+			/* the time of its children counts from now on, or not any more */
+			p->cputime += tmp_process->with_children ? tmp_process->children_cputime
+													 : -tmp_process->children_cputime;
+			p->with_children = tmp_process->with_children;
+		}
+		if (p->pgid != tmp_process->pgid)
+		{
+			p->pgid = tmp_process->pgid;
+			*changed = 1;
+		}
+		/* its CPU usage is updated at the end of the update */
+		if (samples->count == samples->size)
+		{
+			samples->size = MAX(2 * samples->size, 16);
+			samples->procs = (struct process **)realloc(samples->procs, samples->size * sizeof(struct process *));
+			samples->cputimes = (double *)realloc(samples->cputimes, samples->size * sizeof(double));
+			samples->with_children = (int *)realloc(samples->with_children, samples->size * sizeof(int));
+			if (samples->procs == NULL || samples->cputimes == NULL || samples->with_children == NULL)
 			{
-				double sample;
-				add_elem(pgroup->proclist, p);
-				if (dt < MIN_DT)
-					continue;
-				/* process exists. update CPU usage */
-				sample = (tmp_process.cputime - p->cputime) / dt;
-				if (p->cpu_usage < 0)
-				{
-					/* initialization */
-					p->cpu_usage = sample;
-				}
-				else
-				{
-					/* usage adjustment */
-					p->cpu_usage = (1.0 - ALPHA) * p->cpu_usage + ALPHA * sample;
-				}
-				p->cputime = tmp_process.cputime;
+				exit(-1);
 			}
 		}
+		samples->procs[samples->count] = p;
+		samples->cputimes[samples->count] = tmp_process->cputime;
+		samples->with_children[samples->count] = with_children;
+		samples->count++;
 	}
-	close_process_iterator(&it);
+	p->generation = pgroup->generation + 1;
+	return p;
+}
+
+/* search the members of the group, and sample the cpu time of those
+which were members already
+the subtrees of the targets are walked down from the children files of
+the kernel, or else from a single scan of all the processes: the cost
+does not grow with the number of targets
+return:  1 if processes joined or left the group, 0 otherwise */
+int update_process_group(struct process_group *pgroup)
+{
+	struct process_iterator it;
+	struct process tmp_process;
+	struct process_filter filter;
+	struct list_node *node;
+	struct timespec now;
+	double dt;
+	/* members before the update */
+	int old_count;
+	/* members joined or changed process group */
+	int changed = 0;
+	/* members before the update */
+	struct list previous;
+	/* members to sample and their cpu time read on the way */
+	struct samples samples = {NULL, NULL, NULL, 0, 0};
+	/* the processes whose children are members, walked in turn */
+	struct list parents;
+	struct list children;
+	/* the parents of all the processes, if the kernel lists no children */
+	struct family *families = NULL;
+	int family_count = 0;
+	int i;
+	if (get_time(&now))
+	{
+		exit(1);
+	}
+	/* time elapsed from previous sample (in ms) */
+	dt = timediff_in_ms(&now, &pgroup->last_update);
+	pgroup->sample_cputime = 0;
+	pgroup->sample_interval = 0;
+	old_count = pgroup->proclist->count;
+	/* the processes forked after it are searched when the members stop */
+	pgroup->last_pid = get_last_pid();
+	if (pgroup->name != NULL)
+		update_named_targets(pgroup);
+	/* kept until the members gone are accounted */
+	previous = *pgroup->proclist;
+	init_list(pgroup->proclist, sizeof(pid_t));
+	init_list(&parents, sizeof(pid_t));
+	init_list(&children, sizeof(pid_t));
+
+	for (node = pgroup->targets->first; node != NULL; node = node->next)
+	{
+		pid_t pid = *(pid_t *)node->data;
+		int with_children = pgroup->include_children &&
+							locate_elem(pgroup->leaves, &pid) == NULL;
+		if (pid == 0)
+		{
+			/* all the processes */
+			filter.pid = 0;
+			filter.include_children = 0;
+			filter.comm = NULL;
+			init_process_iterator(&it, &filter);
+			while (get_next_process(&it, &tmp_process) != -1)
+				join_group(pgroup, &tmp_process, with_children, &samples, &changed);
+			close_process_iterator(&it);
+			continue;
+		}
+		if (read_process(pid, &tmp_process) == 0)
+			join_group(pgroup, &tmp_process, with_children, &samples, &changed);
+		/* the subtree of the reaper is walked, but it is no member */
+		if (with_children)
+			add_elem(&parents, node->data);
+	}
+	for (node = parents.first; node != NULL; node = node->next)
+	{
+		pid_t pid = *(pid_t *)node->data;
+		struct list_node *child;
+		if (families == NULL && get_process_children(pid, &children) < 0)
+			families = scan_families(&family_count);
+		if (families != NULL)
+			find_children(families, family_count, pid, &children);
+		for (child = children.first; child != NULL; child = child->next)
+		{
+			struct process *p;
+			int leaf;
+			if (read_process(*(pid_t *)child->data, &tmp_process) != 0)
+				continue;
+			/* the children of a leaf are not members */
+			leaf = locate_elem(pgroup->leaves, &tmp_process.pid) != NULL;
+			if ((p = join_group(pgroup, &tmp_process, !leaf, &samples, &changed)) != NULL && !leaf)
+				add_elem(&parents, p);
+		}
+		destroy_list(&children);
+	}
+	/* the targets are not owned by parents */
+	clear_list(&parents);
+	free(families);
+	account_gone_members(pgroup, &previous);
+	clear_list(&previous);
+	if (pgroup->targets_changed)
+	{
+		/* the other processes of a pgid may be members now */
+		destroy_list(pgroup->mixed_pgids);
+		init_list(pgroup->mixed_pgids, sizeof(pid_t));
+	}
+	pgroup->targets_changed = 0;
+	changed = changed || old_count != pgroup->proclist->count;
+	if (changed || pgroup->pgids_stale)
+		update_pgids(pgroup);
+	if (dt >= MIN_DT)
+	{
+		/* read all the cpu times again at once, if possible, the reads
+		of the update were spread over the whole search */
+		if (samples.count > 0)
+			sample_cputimes(&pgroup->sampler, samples.procs, samples.count,
+							samples.cputimes, samples.with_children, NULL);
+		for (i = 0; i < samples.count; i++)
+			update_cpu_usage(pgroup, samples.procs[i], samples.cputimes[i], dt);
+		pgroup->sample_interval = dt;
+		pgroup->last_update = now;
+	}
+	free(samples.procs);
+	free(samples.cputimes);
+	free(samples.with_children);
+	return changed;
+}
+
+/* sample the cpu time and the process group of the members without
+searching new ones, the members gone leave the group, it costs a read
+per member at most
+the members are searched instead if the targets changed
+return:  1 if processes left the group, 0 otherwise */
+int sample_process_group(struct process_group *pgroup)
+{
+	struct process tmp_process;
+	struct list_node *node;
+	struct timespec now;
+	double dt;
+	struct list previous;
+	struct process **sampled;
+	double *cputimes;
+	int *with_children;
+	pid_t *pgids;
+	char *gone;
+	int count = pgroup->proclist->count, i, regroup = 0;
+	if (pgroup->targets_changed || count == 0)
+		return update_process_group(pgroup);
+	if (get_time(&now))
+	{
+		exit(1);
+	}
+	dt = timediff_in_ms(&now, &pgroup->last_update);
+	pgroup->sample_cputime = 0;
+	pgroup->sample_interval = 0;
 	if (dt < MIN_DT)
-		return;
+		return 0;
+	sampled = (struct process **)malloc(count * sizeof(struct process *));
+	cputimes = (double *)malloc(count * sizeof(double));
+	with_children = (int *)malloc(count * sizeof(int));
+	pgids = (pid_t *)malloc(count * sizeof(pid_t));
+	gone = (char *)calloc(count, sizeof(char));
+	if (sampled == NULL || cputimes == NULL || with_children == NULL || pgids == NULL ||
+		gone == NULL)
+	{
+		exit(-1);
+	}
+	for (node = pgroup->proclist->first, i = 0; node != NULL; node = node->next, i++)
+	{
+		sampled[i] = (struct process *)node->data;
+		sampled[i]->used = -1;
+		cputimes[i] = -1;
+		with_children[i] = sampled[i]->with_children;
+		pgids[i] = sampled[i]->pgid;
+	}
+	sample_cputimes(&pgroup->sampler, sampled, count, cputimes, with_children, pgids);
+	/* the processes the sampler did not read are read one at a time */
+	for (i = 0; i < count; i++)
+	{
+		if (cputimes[i] >= 0)
+			continue;
+		errno = 0;
+		if (read_process(sampled[i]->pid, &tmp_process) == 0)
+		{
+			cputimes[i] = tmp_process.cputime +
+						  (with_children[i] ? tmp_process.children_cputime : 0);
+			pgids[i] = tmp_process.pgid;
+		}
+		else if (errno == 0 || errno == ENOENT || errno == ESRCH)
+			gone[i] = 1; /* the process is gone, or a zombie */
+		/* otherwise it is left unsampled, out of descriptors for instance */
+	}
+	previous = *pgroup->proclist;
+	init_list(pgroup->proclist, sizeof(pid_t));
+	for (i = 0; i < count; i++)
+	{
+		if (gone[i])
+			continue;
+		add_elem(pgroup->proclist, sampled[i]);
+		/* a member which moved to another process group is not signalled
+		through the old one any more */
+		if (sampled[i]->pgid != pgids[i])
+		{
+			sampled[i]->pgid = pgids[i];
+			regroup = 1;
+		}
+	}
+	account_gone_members(pgroup, &previous);
+	clear_list(&previous);
+	for (i = 0; i < count; i++)
+	{
+		if (cputimes[i] >= 0)
+			update_cpu_usage(pgroup, sampled[i], cputimes[i], dt);
+	}
+	free(sampled);
+	free(cputimes);
+	free(with_children);
+	free(pgids);
+	free(gone);
+	if (pgroup->proclist->count != count || regroup || pgroup->pgids_stale)
+		update_pgids(pgroup);
+	pgroup->sample_interval = dt;
 	pgroup->last_update = now;
+	return pgroup->proclist->count != count;
+}
+
+/* the cpu time accounted for a member which left the group is owed by its
+parent, if it is a member: it accounts the time again once it waits for it */
+static void charge_parent(struct process_group *pgroup, const struct process *p)
+{
+	struct process *parent = locate_process(pgroup, p->ppid);
+	if (parent != NULL && parent->generation == pgroup->generation)
+		parent->children_debt += p->cputime - p->start_cputime;
+}
+
+/* account the members of previous which are not members any more, the
+whole pgids of those still running cannot be signalled any more
+previous: the members before the last update */
+void account_gone_members(struct process_group *pgroup, const struct list *previous)
+{
+	struct list_node *node;
+	pgroup->generation++;
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+		((struct process *)node->data)->generation = pgroup->generation;
+	for (node = previous->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		if (p->generation == pgroup->generation)
+			continue;
+		charge_parent(pgroup, p);
+		if (locate_elem(pgroup->pgids, &p->pgid) != NULL &&
+			(kill(p->pid, 0) == 0 || errno != ESRCH))
+		{
+			destroy_node(pgroup->pgids, locate_node(pgroup->pgids, &p->pgid));
+			add_pgid(pgroup->mixed_pgids, p->pgid);
+		}
+	}
 }
 
 int remove_process(struct process_group *pgroup, pid_t pid)
@@ -287,6 +926,237 @@ int remove_process(struct process_group *pgroup, pid_t pid)
 	node = (struct list_node *)locate_node(pgroup->proctable[hashkey], &pid);
 	if (node == NULL)
 		return 2;
+	charge_parent(pgroup, (const struct process *)node->data);
 	delete_node(pgroup->proctable[hashkey], node);
 	return 0;
 }
+
+/* look for a process of the group by pid
+return:  the process descriptor, NULL if pid is not in the group */
+struct process *locate_process(struct process_group *pgroup, pid_t pid)
+{
+	int hashkey = pid_hashfn(pid);
+	if (pgroup->proctable[hashkey] == NULL)
+		return NULL;
+	return (struct process *)locate_elem(pgroup->proctable[hashkey], &pid);
+}
+
+/* add a pid to the targets of the group
+return:  0 if the target was added
+		 1 if it was already a target */
+int add_target(struct process_group *pgroup, pid_t pid)
+{
+	pid_t *target;
+	if (locate_elem(pgroup->targets, &pid) != NULL)
+		return 1;
+	target = (pid_t *)malloc(sizeof(pid_t));
+	if (target == NULL)
+	{
+		exit(-1);
+	}
+	*target = pid;
+	add_elem(pgroup->targets, target);
+	pgroup->targets_changed = 1;
+	return 0;
+}
+
+/* remove a pid from the targets of the group
+the processes of its subtree leave the group at the next update
+return:  0 if the target was removed
+		 1 if it was not a target */
+int remove_target(struct process_group *pgroup, pid_t pid)
+{
+	struct list_node *node = locate_node(pgroup->targets, &pid);
+	if (node == NULL)
+		return 1;
+	destroy_node(pgroup->targets, node);
+	set_target_children(pgroup, pid, 1);
+	pgroup->targets_changed = 1;
+	return 0;
+}
+
+/* make the children of a subreaper targets, the orphans it adopts stay
+in the group instead of escaping to init
+the limiter may be one of its children, it is never a member */
+void set_target_reaper(struct process_group *pgroup, pid_t reaper)
+{
+	pgroup->reaper = reaper;
+	add_target(pgroup, reaper);
+}
+
+/* choose whether the children of a target are members, include_children
+must be set in the group too */
+void set_target_children(struct process_group *pgroup, pid_t pid, int include_children)
+{
+	struct list_node *node = locate_node(pgroup->leaves, &pid);
+	if (include_children && node != NULL)
+	{
+		destroy_node(pgroup->leaves, node);
+		pgroup->targets_changed = 1;
+	}
+	else if (!include_children && node == NULL)
+	{
+		pid_t *leaf = (pid_t *)malloc(sizeof(pid_t));
+		if (leaf == NULL)
+		{
+			exit(-1);
+		}
+		*leaf = pid;
+		add_elem(pgroup->leaves, leaf);
+		pgroup->targets_changed = 1;
+	}
+}
+
+/* choose whether the children of all the targets are members, they join
+or leave the group at the next update */
+void set_include_children(struct process_group *pgroup, int include_children)
+{
+	if (pgroup->include_children == include_children)
+		return;
+	pgroup->include_children = include_children;
+	/* the children must not be signalled through their pgid meanwhile */
+	destroy_list(pgroup->pgids);
+	init_list(pgroup->pgids, sizeof(pid_t));
+	pgroup->targets_changed = 1;
+}
+
+/* check if a process group id can be signalled as a whole
+return:  1 if all the processes of pgid are members of the group
+		 0 otherwise */
+int is_whole_pgid(struct process_group *pgroup, pid_t pgid)
+{
+	return locate_elem(pgroup->pgids, &pgid) != NULL;
+}
+
+/* a child forked by a member since the last update joins the group
+return:  the member, NULL if it cannot join */
+static struct process *capture_child(struct process_group *pgroup, pid_t pid, struct process *tmp_process)
+{
+	struct process *p = locate_process(pgroup, pid);
+	if (pid == pgroup->reaper || pid == getpid() ||
+		(p != NULL && p->generation == pgroup->generation))
+		return NULL;
+	/* as in the updates, the parents count the time of their children */
+	tmp_process->cputime += tmp_process->children_cputime;
+	tmp_process->with_children = 1;
+	/* a child sharing the pgid of its parent leaves it whole or not,
+	the pgids are looked for again only for a new one */
+	if (locate_elem(pgroup->pgids, &tmp_process->pgid) == NULL &&
+		locate_elem(pgroup->mixed_pgids, &tmp_process->pgid) == NULL)
+		pgroup->pgids_stale = 1;
+	if (p == NULL)
+		p = add_process(pgroup, tmp_process);
+	else
+		init_member(pgroup, p, tmp_process);
+	return p;
+}
+
+/* find the children of the parents in the children files of their threads
+unread: the parents whose children cannot be read are appended to it
+return:  number of processes found */
+static int walk_children(struct process_group *pgroup, struct list *parents, struct list *unread,
+						 void (*found)(void *data, struct process *p), void *data)
+{
+	struct process tmp_process;
+	struct list children;
+	struct list_node *node, *child;
+	int count = 0, ret;
+	init_list(&children, sizeof(pid_t));
+	/* the children found are appended to parents, and walked in turn */
+	for (node = parents->first; node != NULL; node = node->next)
+	{
+		const struct process *parent = (const struct process *)node->data;
+		if (locate_elem(pgroup->leaves, &parent->pid) != NULL)
+			continue;
+		if ((ret = get_process_children(parent->pid, &children)) != 0)
+		{
+			/* a parent gone has no children left */
+			if (ret < 0)
+				add_elem(unread, node->data);
+			destroy_list(&children);
+			continue;
+		}
+		for (child = children.first; child != NULL; child = child->next)
+		{
+			struct process *p;
+			pid_t pid = *(pid_t *)child->data;
+			if (read_process(pid, &tmp_process) != 0 ||
+				(p = capture_child(pgroup, pid, &tmp_process)) == NULL)
+				continue;
+			add_elem(parents, p);
+			found(data, p);
+			count++;
+		}
+		destroy_list(&children);
+	}
+	return count;
+}
+
+/* find the children of the parents scanning all the processes, until a
+scan finds no more of them or after CAPTURE_ROUNDS scans
+return:  number of processes found */
+static int scan_children(struct process_group *pgroup, struct list *parents,
+						 void (*found)(void *data, struct process *p), void *data)
+{
+	struct process_iterator it;
+	struct process tmp_process;
+	struct process_filter filter;
+	int round, count = 0, last;
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	for (round = 0; round < CAPTURE_ROUNDS; round++)
+	{
+		last = count;
+		init_process_iterator(&it, &filter);
+		while (get_next_process(&it, &tmp_process) != -1)
+		{
+			struct process *p;
+			if (locate_elem(parents, &tmp_process.ppid) == NULL ||
+				locate_elem(pgroup->leaves, &tmp_process.ppid) != NULL ||
+				(p = capture_child(pgroup, tmp_process.pid, &tmp_process)) == NULL)
+				continue;
+			add_elem(parents, p);
+			found(data, p);
+			count++;
+		}
+		close_process_iterator(&it);
+		if (count == last)
+			break;
+	}
+	return count;
+}
+
+/* make members the children forked by some members since the last update,
+and their own children
+the children files of the members are walked if the kernel has them, all
+the processes are scanned for the children of the members whose files
+cannot be read, and nothing is done at all if no process was forked on
+the system since the last update
+parents: members whose children are searched, the ones found are appended
+found: called on every process found, as soon as it is found
+return:  number of processes found */
+int capture_children(struct process_group *pgroup, struct list *parents,
+					 void (*found)(void *data, struct process *p), void *data)
+{
+	/* parents whose children are not listed, and the processes found
+	scanning for them */
+	struct list unread;
+	struct list_node *last;
+	int count;
+	if (!pgroup->include_children ||
+		(pgroup->last_pid > 0 && get_last_pid() == pgroup->last_pid))
+		return 0;
+	init_list(&unread, sizeof(pid_t));
+	count = walk_children(pgroup, parents, &unread, found, data);
+	if (unread.count > 0)
+	{
+		last = unread.last;
+		count += scan_children(pgroup, &unread, found, data);
+		for (last = last->next; last != NULL; last = last->next)
+			add_elem(parents, last->data);
+	}
+	/* the members are owned by the group */
+	clear_list(&unread);
+	return count;
+}
@@ -30,9 +30,17 @@
 #include <string.h>
 
 #include "process_iterator.h"
+#include "sampler.h"
 
 #include "list.h"
 
+/* parameter in range 0-1 */
+#define ALPHA 0.08
+/* shortest interval between two samples (in ms) */
+#define MIN_DT 20
+/* most scans looking for the children forked by stopped members */
+#define CAPTURE_ROUNDS 4
+
 #define PIDHASH_SZ 1024
 #define pid_hashfn(x) ((((x) >> 8) ^ (x)) & (PIDHASH_SZ - 1))
 
@@ -41,14 +49,46 @@ struct process_group
 	/* hashtable with all the processes (array of struct list of struct process) */
 	struct list *proctable[PIDHASH_SZ];
 	struct list *proclist;
-	pid_t target_pid;
+	/* pids whose processes (and children, if include_children) form the group */
+	struct list *targets;
+	/* basename of the program whose instances are all targets, NULL if none */
+	char *name;
+	/* targets (of pid_t) added as instances of the program */
+	struct list *named;
+	/* targets (of pid_t) whose children are not members, even with include_children */
+	struct list *leaves;
+	/* subreaper adopting the orphans of the group, 0 if none
+	it is a target, but neither it nor the limiter are members */
+	pid_t reaper;
 	int include_children;
 	struct timespec last_update;
+	/* cputime used by the members in the last sampling interval (in ms) */
+	double sample_cputime;
+	/* length of the last sampling interval (in ms), 0 if the last update did not sample */
+	double sample_interval;
+	/* process group ids (of pid_t) whose processes are all members of the group,
+	each of them can be signalled at once with kill(-pgid, sig) */
+	struct list *pgids;
+	/* process group ids shared with other processes, they are not checked
+	again until the targets change */
+	struct list *mixed_pgids;
+	/* members may have joined another process group since pgids was built */
+	int pgids_stale;
+	/* number of updates, to tell the members gone */
+	int generation;
+	/* the targets changed since the last search of the members */
+	int targets_changed;
+	/* last pid created on the system before the last search, -1 if unknown */
+	pid_t last_pid;
+	/* reads the cpu time of the members in batches, if supported */
+	struct stat_sampler sampler;
 };
 
 int init_process_group(struct process_group *pgroup, pid_t target_pid, int include_children);
 
-void update_process_group(struct process_group *pgroup);
+int update_process_group(struct process_group *pgroup);
+
+int sample_process_group(struct process_group *pgroup);
 
 int close_process_group(struct process_group *pgroup);
 
@@ -58,4 +98,29 @@ pid_t find_process_by_name(char *process_name);
 
 int remove_process(struct process_group *pgroup, pid_t pid);
 
+struct process *locate_process(struct process_group *pgroup, pid_t pid);
+
+struct process *add_process(struct process_group *pgroup, const struct process *proc);
+
+void update_cpu_usage(struct process_group *pgroup, struct process *p, double cputime, double dt);
+
+void account_gone_members(struct process_group *pgroup, const struct list *previous);
+
+int add_target(struct process_group *pgroup, pid_t pid);
+
+int remove_target(struct process_group *pgroup, pid_t pid);
+
+void set_target_name(struct process_group *pgroup, const char *name);
+
+void set_target_children(struct process_group *pgroup, pid_t pid, int include_children);
+
+void set_target_reaper(struct process_group *pgroup, pid_t reaper);
+
+void set_include_children(struct process_group *pgroup, int include_children);
+
+int is_whole_pgid(struct process_group *pgroup, pid_t pgid);
+
+int capture_children(struct process_group *pgroup, struct list *parents,
+					 void (*found)(void *data, struct process *p), void *data);
+
 #endif
@@ -29,6 +29,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <limits.h>
+
+#include "list.h"
 #if defined(__linux__)
 #include <linux/limits.h>
 #endif
@@ -52,10 +54,29 @@ struct process
 	pid_t pid;
 	/* ppid of the process */
 	pid_t ppid;
+	/* process group id of the process */
+	pid_t pgid;
 	/* cputime used by the process (in milliseconds) */
 	double cputime;
+	/* cputime used by the children it waited for (in milliseconds) */
+	double children_cputime;
+	/* 1 if the cputime accounted for it includes children_cputime */
+	int with_children;
+	/* cputime when the process joined the group (in milliseconds) */
+	double start_cputime;
+	/* cputime of its children which left the group, accounted already and
+	not to be accounted again once it waits for them (in milliseconds) */
+	double children_debt;
+	/* last update of the group the process was a member at */
+	int generation;
 	/* actual cpu usage estimation (value in range 0-1) */
 	double cpu_usage;
+	/* cputime accounted at the last sample of the group, children debt
+	paid (in milliseconds), -1 if it was not sampled */
+	double used;
+	/* time spent waiting for a cpu at the last check of the cpu pressure
+	(in milliseconds), -1 if not read yet */
+	double run_delay;
 	/* absolute path of the executable file */
 	char command[PATH_MAX + 1];
 	/* maximum command length */
@@ -66,12 +87,25 @@ struct process_filter
 {
 	pid_t pid;
 	int include_children;
+	/* if not NULL, the processes whose command is not named so (basename
+	of its first argument) may be skipped, see may_be_named() */
+	const char *comm;
 };
 
 struct process_iterator
 {
 #if defined(__linux__)
 	DIR *dip;
+	/* pids read in advance by a sharded scan, NULL for a serial scan */
+	pid_t *pids;
+	int count;
+	int i;
+	/* processes of pids read in parallel, valid[j] is 0 if window[j]
+	was filtered out or could not be read */
+	struct process *window;
+	int *valid;
+	int window_start;
+	int window_len;
 #elif defined(__FreeBSD__)
 	kvm_t *kd;
 	struct kinfo_proc *procs;
@@ -91,8 +125,20 @@ int get_next_process(struct process_iterator *i, struct process *p);
 
 int close_process_iterator(struct process_iterator *i);
 
+void set_scan_workers(int workers);
+
+int set_procfs_root(const char *root);
+
+const char *get_procfs_root(void);
+
+int may_be_named(pid_t pid, const char *name);
+
 int is_child_of(pid_t child_pid, pid_t parent_pid);
 
 pid_t getppid_of(pid_t pid);
 
+int get_process_children(pid_t pid, struct list *children);
+
+pid_t get_last_pid(void);
+
 #endif
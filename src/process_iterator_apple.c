@@ -97,7 +97,9 @@ static void pti2proc(struct proc_taskallinfo *ti, struct process *process)
 {
 	process->pid = ti->pbsd.pbi_pid;
 	process->ppid = ti->pbsd.pbi_ppid;
+	process->pgid = ti->pbsd.pbi_pgid;
 	process->cputime = ti->ptinfo.pti_total_user / 1e6 + ti->ptinfo.pti_total_system / 1e6;
+	process->children_cputime = 0;
 	if (ti->pbsd.pbi_name[0] != '\0')
 	{
 		process->max_cmd_len = MIN(sizeof(process->command), sizeof(ti->pbsd.pbi_name)) - 1;
@@ -152,6 +154,18 @@ int is_child_of(pid_t child_pid, pid_t parent_pid)
 	return child_pid == parent_pid;
 }
 
+int get_process_children(pid_t pid, struct list *children)
+{
+	(void)pid;
+	(void)children;
+	return -1;
+}
+
+pid_t get_last_pid(void)
+{
+	return (pid_t)(-1);
+}
+
 int get_next_process(struct process_iterator *it, struct process *p)
 {
 	if (it->i == it->count)
@@ -211,5 +225,31 @@ int close_process_iterator(struct process_iterator *it)
 	return 0;
 }
 
+/* the process table is read at once, there is nothing to shard */
+void set_scan_workers(int workers)
+{
+	(void)workers;
+}
+
+/* there is no procfs to read */
+int set_procfs_root(const char *root)
+{
+	(void)root;
+	return -1;
+}
+
+const char *get_procfs_root(void)
+{
+	return "/proc";
+}
+
+/* the processes are not told apart by their name before being read */
+int may_be_named(pid_t pid, const char *name)
+{
+	(void)pid;
+	(void)name;
+	return 1;
+}
+
 #endif
 #endif
@@ -61,7 +61,9 @@ static void kproc2proc(kvm_t *kd, struct kinfo_proc *kproc, struct process *proc
 	char **args;
 	proc->pid = kproc->ki_pid;
 	proc->ppid = kproc->ki_ppid;
+	proc->pgid = kproc->ki_pgid;
 	proc->cputime = kproc->ki_runtime / 1000.0;
+	proc->children_cputime = 0;
 	proc->max_cmd_len = sizeof(proc->command) - 1;
 	if ((args = kvm_getargv(kd, kproc, sizeof(proc->command))) != NULL)
 	{
@@ -134,6 +136,22 @@ int is_child_of(pid_t child_pid, pid_t parent_pid)
 	return ret;
 }
 
+int get_process_children(pid_t pid, struct list *children)
+{
+	(void)pid;
+	(void)children;
+	return -1;
+}
+
+pid_t get_last_pid(void)
+{
+	int pid;
+	size_t len = sizeof(pid);
+	if (sysctlbyname("kern.lastpid", &pid, &len, NULL, 0) != 0)
+		return (pid_t)(-1);
+	return (pid_t)pid;
+}
+
 int get_next_process(struct process_iterator *it, struct process *p)
 {
 	if (it->i == it->count)
@@ -188,5 +206,31 @@ int close_process_iterator(struct process_iterator *it)
 	return 0;
 }
 
+/* the process table is read at once, there is nothing to shard */
+void set_scan_workers(int workers)
+{
+	(void)workers;
+}
+
+/* there is no procfs to read */
+int set_procfs_root(const char *root)
+{
+	(void)root;
+	return -1;
+}
+
+const char *get_procfs_root(void)
+{
+	return "/proc";
+}
+
+/* the processes are not told apart by their name before being read */
+int may_be_named(pid_t pid, const char *name)
+{
+	(void)pid;
+	(void)name;
+	return 1;
+}
+
 #endif
 #endif
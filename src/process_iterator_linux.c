@@ -32,13 +32,53 @@
 #include <linux/magic.h>
 #include "process_iterator.h"
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
+
+/* a scan is split among threads only if there are at least so many processes */
+#define SHARD_MIN_PROCS 1024
+/* processes read in parallel before being returned */
+#define SHARD_WINDOW 1024
+#define SHARD_MAX_WORKERS 8
+
+/* size of the name of a process (comm) in the kernel, with the final NUL */
+#define COMM_LEN 16
+
+/* threads reading /proc, 0 to choose from the number of cpu */
+static int scan_workers = 0;
+
+/* directory read in place of /proc, fixtures of the tests are not procfs */
+static char procfs_root[PATH_MAX + 1] = "/proc";
+
+void set_scan_workers(int workers)
+{
+	scan_workers = workers;
+}
+
+/* read the processes from root instead of /proc
+return:  0 on success, -1 if the path is too long */
+int set_procfs_root(const char *root)
+{
+	if (strlen(root) >= sizeof(procfs_root))
+		return -1;
+	strcpy(procfs_root, root);
+	return 0;
+}
+
+const char *get_procfs_root(void)
+{
+	return procfs_root;
+}
 
 static int check_proc(void)
 {
 	struct statfs mnt;
+	struct stat st;
+	if (strcmp(procfs_root, "/proc") != 0)
+		return stat(procfs_root, &st) == 0 && S_ISDIR(st.st_mode);
 	if (statfs("/proc", &mnt) < 0)
 		return 0;
 	if (mnt.f_type != PROC_SUPER_MAGIC)
@@ -46,6 +86,67 @@ static int check_proc(void)
 	return 1;
 }
 
+static int is_numeric(const char *str)
+{
+	for (; *str != '\0' && isdigit(*str); str++)
+		;
+	return *str == '\0';
+}
+
+static int get_workers(void)
+{
+	long ncpu;
+	if (scan_workers > 0)
+		return scan_workers;
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	return (int)MAX(MIN(ncpu, SHARD_MAX_WORKERS), 1);
+}
+
+/* read all the pids in advance for a sharded scan
+it->pids is left NULL if a serial scan is better */
+static void init_shards(struct process_iterator *it)
+{
+	struct dirent *dit;
+	int size = 0;
+	if (get_workers() < 2)
+		return;
+	while ((dit = readdir(it->dip)) != NULL)
+	{
+		pid_t pid;
+#ifdef _DIRENT_HAVE_D_TYPE
+		if (dit->d_type != DT_DIR)
+			continue;
+#endif
+		if (!is_numeric(dit->d_name) || (pid = (pid_t)atol(dit->d_name)) <= 0)
+			continue;
+		if (it->count == size)
+		{
+			size = MAX(2 * size, SHARD_WINDOW);
+			it->pids = (pid_t *)realloc(it->pids, size * sizeof(pid_t));
+			if (it->pids == NULL)
+			{
+				exit(-1);
+			}
+		}
+		it->pids[it->count++] = pid;
+	}
+	if (it->count < SHARD_MIN_PROCS && scan_workers == 0)
+	{
+		/* not worth the threads */
+		free(it->pids);
+		it->pids = NULL;
+		it->count = 0;
+		rewinddir(it->dip);
+		return;
+	}
+	it->window = (struct process *)malloc(SHARD_WINDOW * sizeof(struct process));
+	it->valid = (int *)malloc(SHARD_WINDOW * sizeof(int));
+	if (it->window == NULL || it->valid == NULL)
+	{
+		exit(-1);
+	}
+}
+
 int init_process_iterator(struct process_iterator *it, struct process_filter *filter)
 {
 	if (!check_proc())
@@ -54,27 +155,74 @@ int init_process_iterator(struct process_iterator *it, struct process_filter *fi
 		exit(-2);
 	}
 	/* open a directory stream to /proc directory */
-	if ((it->dip = opendir("/proc")) == NULL)
+	if ((it->dip = opendir(procfs_root)) == NULL)
 	{
 		perror("opendir");
 		return -1;
 	}
 	it->filter = filter;
+	it->pids = NULL;
+	it->count = it->i = 0;
+	it->window = NULL;
+	it->valid = NULL;
+	it->window_start = it->window_len = 0;
+	if (filter->pid == 0 || filter->include_children)
+		init_shards(it);
 	return 0;
 }
 
+/* check if the process may be named name (basename of its command)
+its name (comm) decides, it is the cheapest to read: a process renamed
+with prctl(PR_SET_NAME), or started with exec -a, is missed unless its
+name is as long as the kernel allows (COMM_LEN-1), truncated maybe, then
+the command line decides
+return:  1 if the process may be named name (or its name cannot be read)
+		 0 otherwise */
+int may_be_named(pid_t pid, const char *name)
+{
+	char file[PATH_MAX + 32], comm[COMM_LEN + 1], command[PATH_MAX + 1];
+	const char *base;
+	ssize_t len;
+	int fd;
+	sprintf(file, "%s/%ld/comm", procfs_root, (long)pid);
+	if ((fd = open(file, O_RDONLY)) >= 0)
+	{
+		len = read(fd, comm, COMM_LEN);
+		close(fd);
+		if (len > 0 && comm[len - 1] == '\n')
+			len--;
+		/* the kernel truncates the names */
+		if (len > 0 && (size_t)len == MIN(strlen(name), COMM_LEN - 1) &&
+			strncmp(comm, name, len) == 0)
+			return 1;
+		if (len > 0 && len < COMM_LEN - 1)
+			return 0;
+	}
+	/* the first argument of the command line */
+	sprintf(file, "%s/%ld/cmdline", procfs_root, (long)pid);
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return 1;
+	len = read(fd, command, sizeof(command) - 1);
+	close(fd);
+	if (len < 0 || memchr(command, '\0', len) == NULL)
+		return 1;
+	base = strrchr(command, '/');
+	base = base != NULL ? base + 1 : command;
+	return strcmp(base, name) == 0;
+}
+
 static int read_process_info(pid_t pid, struct process *p)
 {
-	char statfile[32], exefile[32], state;
-	double utime, stime;
-	long ppid;
+	char statfile[PATH_MAX + 32], exefile[PATH_MAX + 32], state;
+	double utime, stime, cutime, cstime;
+	long ppid, pgid;
 	FILE *fd;
 	int ret = 0;
 
 	p->pid = pid;
 
 	/* read command line */
-	sprintf(exefile, "/proc/%ld/cmdline", (long)p->pid);
+	sprintf(exefile, "%s/%ld/cmdline", procfs_root, (long)p->pid);
 	if ((fd = fopen(exefile, "r")) != NULL)
 	{
 		if (fgets(p->command, sizeof(p->command), fd) == NULL)
@@ -98,11 +246,11 @@ static int read_process_info(pid_t pid, struct process *p)
 	}
 
 	/* read stat file */
-	sprintf(statfile, "/proc/%ld/stat", (long)p->pid);
+	sprintf(statfile, "%s/%ld/stat", procfs_root, (long)p->pid);
 	if ((fd = fopen(statfile, "r")) != NULL)
 	{
-		if (fscanf(fd, "%*d (%*[^)]) %c %ld %*d %*d %*d %*d %*d %*d %*d %*d %*d %lf %lf",
-				   &state, &ppid, &utime, &stime) != 4 ||
+		if (fscanf(fd, "%*d (%*[^)]) %c %ld %ld %*d %*d %*d %*d %*d %*d %*d %*d %lf %lf %lf %lf",
+				   &state, &ppid, &pgid, &utime, &stime, &cutime, &cstime) != 7 ||
 			strchr("ZXx", state) != NULL)
 		{
 			ret = -1;
@@ -110,7 +258,9 @@ static int read_process_info(pid_t pid, struct process *p)
 		else
 		{
 			p->ppid = (pid_t)ppid;
+			p->pgid = (pid_t)pgid;
 			p->cputime = (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+			p->children_cputime = (cutime + cstime) * 1000 / sysconf(_SC_CLK_TCK);
 		}
 		fclose(fd);
 	}
@@ -124,12 +274,12 @@ static int read_process_info(pid_t pid, struct process *p)
 
 pid_t getppid_of(pid_t pid)
 {
-	char statfile[32];
+	char statfile[PATH_MAX + 32];
 	FILE *fd;
 	long ppid = -1;
 	if (pid <= 0)
 		return (pid_t)(-1);
-	sprintf(statfile, "/proc/%ld/stat", (long)pid);
+	sprintf(statfile, "%s/%ld/stat", procfs_root, (long)pid);
 	if ((fd = fopen(statfile, "r")) != NULL)
 	{
 		if (fscanf(fd, "%*d (%*[^)]) %*c %ld", &ppid) != 1)
@@ -139,12 +289,73 @@ pid_t getppid_of(pid_t pid)
 	return (pid_t)ppid;
 }
 
+/* list the children of a process, from the children files of its threads
+children: their pids (of pid_t) are appended to it
+return:  0 on success, 1 if the process is gone, -1 if its children
+		 cannot be read (the kernel does not list them, or no permission) */
+int get_process_children(pid_t pid, struct list *children)
+{
+	char path[PATH_MAX + 64];
+	struct dirent *dit;
+	DIR *dip;
+	int ret = -1;
+	sprintf(path, "%s/%ld/task", procfs_root, (long)pid);
+	if ((dip = opendir(path)) == NULL)
+		return errno == ENOENT || errno == ESRCH ? 1 : -1;
+	while ((dit = readdir(dip)) != NULL)
+	{
+		FILE *fd;
+		long child;
+		if (!is_numeric(dit->d_name))
+			continue;
+		sprintf(path, "%s/%ld/task/%ld/children", procfs_root, (long)pid, atol(dit->d_name));
+		if ((fd = fopen(path, "r")) == NULL)
+			continue;
+		ret = 0;
+		while (fscanf(fd, "%ld", &child) == 1)
+		{
+			pid_t *p = (pid_t *)malloc(sizeof(pid_t));
+			if (p == NULL)
+			{
+				exit(-1);
+			}
+			*p = (pid_t)child;
+			add_elem(children, p);
+		}
+		fclose(fd);
+	}
+	closedir(dip);
+	/* the threads may have exited meanwhile */
+	sprintf(path, "%s/%ld", procfs_root, (long)pid);
+	if (ret != 0 && access(path, F_OK) != 0)
+		return 1;
+	return ret;
+}
+
+/* the pid of the last process created on the system, it changes
+whenever a process forks
+return:  the pid, -1 if it is unknown */
+pid_t get_last_pid(void)
+{
+	char path[PATH_MAX + 32];
+	FILE *fd;
+	long pid = -1;
+	sprintf(path, "%s/loadavg", procfs_root);
+	if ((fd = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(fd, "%*f %*f %*f %*d/%*d %ld", &pid) != 1)
+			pid = -1;
+		fclose(fd);
+	}
+	return (pid_t)pid;
+}
+
 static int get_start_time(pid_t pid, struct timespec *start_time)
 {
 	struct stat procfs_stat;
-	char procfs_path[32];
+	char procfs_path[PATH_MAX + 32];
 	int ret;
-	sprintf(procfs_path, "/proc/%ld", (long)pid);
+	sprintf(procfs_path, "%s/%ld", procfs_root, (long)pid);
 	ret = stat(procfs_path, &procfs_stat);
 	if (ret == 0 && start_time != NULL)
 		*start_time = procfs_stat.st_ctim;
@@ -181,11 +392,80 @@ int is_child_of(pid_t child_pid, pid_t parent_pid)
 	return 0;
 }
 
-static int is_numeric(const char *str)
+/* part of the window read by a thread */
+struct shard
 {
-	for (; *str != '\0' && isdigit(*str); str++)
-		;
-	return *str == '\0';
+	struct process_iterator *it;
+	int first;
+	int step;
+};
+
+static void *read_shard(void *arg)
+{
+	const struct shard *shard = (const struct shard *)arg;
+	struct process_iterator *it = shard->it;
+	int j;
+	for (j = shard->first; j < it->window_len; j += shard->step)
+	{
+		pid_t pid = it->pids[it->window_start + j];
+		/* same checks as the serial scan */
+		it->valid[j] = (it->filter->pid == 0 ||
+						it->filter->pid == pid ||
+						is_child_of(pid, it->filter->pid)) &&
+					   (it->filter->comm == NULL || may_be_named(pid, it->filter->comm)) &&
+					   read_process_info(pid, &it->window[j]) == 0;
+	}
+	return NULL;
+}
+
+/* read the next window of pids, interleaved among the threads */
+static void read_window(struct process_iterator *it)
+{
+	pthread_t threads[SHARD_MAX_WORKERS];
+	struct shard shards[SHARD_MAX_WORKERS];
+	int started[SHARD_MAX_WORKERS];
+	int w, workers = MIN(get_workers(), SHARD_MAX_WORKERS);
+
+	it->window_start += it->window_len;
+	it->window_len = MIN(SHARD_WINDOW, it->count - it->window_start);
+	for (w = 0; w < workers; w++)
+	{
+		shards[w].it = it;
+		shards[w].first = w;
+		shards[w].step = workers;
+		/* the calling thread reads the first shard */
+		started[w] = w > 0 && pthread_create(&threads[w], NULL, read_shard, &shards[w]) == 0;
+	}
+	for (w = 0; w < workers; w++)
+	{
+		if (!started[w])
+			read_shard(&shards[w]);
+	}
+	for (w = 1; w < workers; w++)
+	{
+		if (started[w])
+			pthread_join(threads[w], NULL);
+	}
+}
+
+/* the processes are returned in the order of the serial scan */
+static int get_next_sharded(struct process_iterator *it, struct process *p)
+{
+	while (it->i < it->count)
+	{
+		int j;
+		if (it->i == it->window_start + it->window_len)
+			read_window(it);
+		j = it->i++ - it->window_start;
+		if (it->valid[j])
+		{
+			memcpy(p, &it->window[j], sizeof(struct process));
+			return 0;
+		}
+	}
+	/* end of processes */
+	close_process_iterator(it);
+	return -1;
 }
 
 int get_next_process(struct process_iterator *it, struct process *p)
@@ -197,6 +477,8 @@ int get_next_process(struct process_iterator *it, struct process *p)
 		/* end of processes */
 		return -1;
 	}
+	if (it->pids != NULL)
+		return get_next_sharded(it, p);
 	if (it->filter->pid != 0 && !it->filter->include_children)
 	{
 		int ret = read_process_info(it->filter->pid, p);
@@ -221,6 +503,8 @@ int get_next_process(struct process_iterator *it, struct process *p)
 			it->filter->pid != p->pid &&
 			!is_child_of(p->pid, it->filter->pid))
 			continue;
+		if (it->filter->comm != NULL && !may_be_named(p->pid, it->filter->comm))
+			continue;
 		if (read_process_info(p->pid, p) != 0)
 			continue;
 		return 0;
@@ -233,6 +517,14 @@ int get_next_process(struct process_iterator *it, struct process *p)
 
 int close_process_iterator(struct process_iterator *it)
 {
+	free(it->pids);
+	free(it->window);
+	free(it->valid);
+	it->pids = NULL;
+	it->window = NULL;
+	it->valid = NULL;
+	it->count = it->i = 0;
+	it->window_start = it->window_len = 0;
 	if (it->dip != NULL && closedir(it->dip) == -1)
 	{
 		perror("closedir");
@@ -0,0 +1,514 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "rules.h"
+
+/* longest line of the rules file */
+#define RULE_LINE_MAX 4096
+/* longest command line compared with the rules */
+#define CMDLINE_MAX 4096
+/* length of the command name of a process, with the null character */
+#define COMM_LEN 16
+
+/* what is known about a process, read only if a rule needs it */
+struct process_info
+{
+	const struct process *proc;
+	int have_exe, have_comm, have_cmdline, have_uid;
+	char exe[PATH_MAX + 1];
+	char comm[COMM_LEN + 1];
+	char cmdline[CMDLINE_MAX];
+	long uid;
+};
+
+static char *copy_string(const char *str)
+{
+	char *copy = (char *)malloc(strlen(str) + 1);
+	if (copy == NULL)
+	{
+		exit(-1);
+	}
+	strcpy(copy, str);
+	return copy;
+}
+
+static void free_rule(struct rule *rule)
+{
+	free(rule->exe);
+	free(rule->comm);
+	if (rule->has_cmdline)
+		regfree(&rule->cmdline);
+}
+
+static int parse_uid(const char *value, long *uid)
+{
+	char *end;
+	struct passwd *pw;
+	*uid = strtol(value, &end, 10);
+	if (end != value && *end == '\0' && *uid >= 0)
+		return 0;
+	if ((pw = getpwnam(value)) == NULL)
+		return -1;
+	*uid = (long)pw->pw_uid;
+	return 0;
+}
+
+/* parse a token KEY or KEY=VALUE, the value may be quoted
+return:  0 if the token was applied to the rule, -1 on errors (printed) */
+static int parse_token(struct rule *rule, char *key, char *value, int ncpu,
+					   const char *path, int line)
+{
+	const char *error = NULL;
+	char *end;
+	if (strcmp(key, "include-children") == 0 && value == NULL)
+	{
+		rule->include_children = 1;
+		return 0;
+	}
+	if (value == NULL || *value == '\0')
+		error = "missing value";
+	else if (strcmp(key, "exe") == 0 && rule->exe == NULL)
+		rule->exe = copy_string(value);
+	else if (strcmp(key, "comm") == 0 && rule->comm == NULL)
+		rule->comm = copy_string(value);
+	else if (strcmp(key, "cmdline") == 0 && !rule->has_cmdline)
+	{
+		if (regcomp(&rule->cmdline, value, REG_EXTENDED | REG_NOSUB) != 0)
+			error = "invalid regular expression";
+		else
+			rule->has_cmdline = 1;
+	}
+	else if (strcmp(key, "uid") == 0 && rule->uid < 0)
+	{
+		if (parse_uid(value, &rule->uid) != 0)
+			error = "unknown user";
+	}
+	else if (strcmp(key, "limit") == 0 && rule->limit < 0)
+	{
+		long limit = strtol(value, &end, 10);
+		if (end == value || *end != '\0' || limit <= 0 || limit > 100 * ncpu)
+			error = "invalid limit";
+		else
+			rule->limit = limit / 100.0;
+	}
+	else
+		error = "unknown or repeated key";
+	if (error == NULL)
+		return 0;
+	fprintf(stderr, "%s:%d: %s: %s\n", path, line, error, key);
+	return -1;
+}
+
+/* parse a line of the rules file into rule
+return:  1 if the line holds a rule, 0 if it is empty, -1 on errors (printed) */
+static int parse_rule(struct rule *rule, char *buf, int ncpu, const char *path, int line)
+{
+	char *p = buf;
+	int tokens = 0;
+	rule->exe = rule->comm = NULL;
+	rule->has_cmdline = 0;
+	rule->uid = -1;
+	rule->limit = -1;
+	rule->include_children = 0;
+	rule->line = line;
+	for (;;)
+	{
+		char *key, *value = NULL;
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+			p++;
+		if (*p == '\0' || *p == '#')
+			break;
+		key = p;
+		while (*p != '\0' && *p != '=' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+			p++;
+		if (*p == '=')
+		{
+			*p++ = '\0';
+			if (*p == '"')
+			{
+				value = ++p;
+				while (*p != '\0' && *p != '"')
+					p++;
+				if (*p != '"')
+				{
+					fprintf(stderr, "%s:%d: unterminated quote\n", path, line);
+					free_rule(rule);
+					return -1;
+				}
+			}
+			else
+			{
+				value = p;
+				while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+					p++;
+			}
+		}
+		if (*p != '\0')
+			*p++ = '\0';
+		if (parse_token(rule, key, value, ncpu, path, line) != 0)
+		{
+			free_rule(rule);
+			return -1;
+		}
+		tokens++;
+	}
+	if (tokens == 0)
+		return 0;
+	if (rule->limit < 0 || (rule->exe == NULL && rule->comm == NULL &&
+							!rule->has_cmdline && rule->uid < 0))
+	{
+		fprintf(stderr, "%s:%d: a rule needs a limit and at least one pattern\n", path, line);
+		free_rule(rule);
+		return -1;
+	}
+	return 1;
+}
+
+/* read all the rules of a file
+return:  0 on success, -1 on errors (printed) */
+static int parse_rules(const char *path, int ncpu, struct rule **rules, int *count)
+{
+	char buf[RULE_LINE_MAX];
+	FILE *fd;
+	int line = 0, size = 0, ret = 0;
+	*rules = NULL;
+	*count = 0;
+	if ((fd = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (ret == 0 && fgets(buf, sizeof(buf), fd) != NULL)
+	{
+		struct rule rule;
+		int n;
+		line++;
+		if ((n = parse_rule(&rule, buf, ncpu, path, line)) < 0)
+			ret = -1;
+		if (n <= 0)
+			continue;
+		if (*count == size)
+		{
+			size = MAX(2 * size, 16);
+			*rules = (struct rule *)realloc(*rules, size * sizeof(struct rule));
+			if (*rules == NULL)
+			{
+				exit(-1);
+			}
+		}
+		(*rules)[(*count)++] = rule;
+	}
+	fclose(fd);
+	if (ret != 0)
+	{
+		while (*count > 0)
+			free_rule(&(*rules)[--*count]);
+		free(*rules);
+		*rules = NULL;
+	}
+	return ret;
+}
+
+static time_t get_mtime(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+/* load the rules of a file and watch its changes
+return:  0 on success, -1 on errors (printed) */
+int load_rules(struct rule_set *rules, const char *path, int ncpu)
+{
+	rules->watch_fd = -1;
+	rules->path = NULL;
+	if (parse_rules(path, ncpu, &rules->rules, &rules->count) != 0)
+		return -1;
+	rules->path = copy_string(path);
+	rules->mtime = get_mtime(path);
+#if defined(__linux__)
+	/* the directory is watched, editors often replace the file */
+	if ((rules->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+	{
+		char *dir = copy_string(path);
+		if (inotify_add_watch(rules->watch_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			close(rules->watch_fd);
+			rules->watch_fd = -1;
+		}
+		free(dir);
+	}
+#endif
+	return 0;
+}
+
+/* check if the rules file changed since the last check, without blocking
+return:  1 if it changed, 0 otherwise */
+int rules_changed(struct rule_set *rules)
+{
+	time_t mtime;
+#if defined(__linux__)
+	if (rules->watch_fd >= 0)
+	{
+		union
+		{
+			struct inotify_event event;
+			char buf[4096];
+		} msg;
+		char *name = copy_string(rules->path);
+		const char *base = basename(name);
+		ssize_t len;
+		int changed = 0;
+		while ((len = read(rules->watch_fd, &msg, sizeof(msg))) > 0)
+		{
+			char *p = msg.buf;
+			while (p < msg.buf + len)
+			{
+				struct inotify_event *ev = (struct inotify_event *)p;
+				if (ev->len > 0 && strcmp(ev->name, base) == 0)
+					changed = 1;
+				p += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+		free(name);
+		return changed;
+	}
+#endif
+	mtime = get_mtime(rules->path);
+	if (mtime == rules->mtime)
+		return 0;
+	rules->mtime = mtime;
+	return 1;
+}
+
+/* load the rules file again, the current rules are kept if it has errors
+return:  0 on success, -1 on errors (printed) */
+int reload_rules(struct rule_set *rules, int ncpu)
+{
+	struct rule *new_rules;
+	int count;
+	if (parse_rules(rules->path, ncpu, &new_rules, &count) != 0)
+		return -1;
+	while (rules->count > 0)
+		free_rule(&rules->rules[--rules->count]);
+	free(rules->rules);
+	rules->rules = new_rules;
+	rules->count = count;
+	return 0;
+}
+
+#if defined(__linux__)
+
+/* read a file of /proc/PID into buf, at most size-1 bytes
+return:  the bytes read, -1 on errors */
+static ssize_t read_proc_file(pid_t pid, const char *file, char *buf, size_t size)
+{
+	char path[PATH_MAX + 32];
+	ssize_t n;
+	int fd;
+	sprintf(path, "%s/%ld/%s", get_procfs_root(), (long)pid, file);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return n;
+}
+
+static void read_exe(struct process_info *info)
+{
+	char path[PATH_MAX + 32];
+	ssize_t n;
+	sprintf(path, "%s/%ld/exe", get_procfs_root(), (long)info->proc->pid);
+	n = readlink(path, info->exe, sizeof(info->exe) - 1);
+	if (n < 0)
+	{
+		/* not allowed to follow the link */
+		strcpy(info->exe, info->proc->command);
+		return;
+	}
+	info->exe[n] = '\0';
+}
+
+static void read_comm(struct process_info *info)
+{
+	if (read_proc_file(info->proc->pid, "comm", info->comm, sizeof(info->comm)) < 0)
+		info->comm[0] = '\0';
+	info->comm[strcspn(info->comm, "\n")] = '\0';
+}
+
+static void read_cmdline(struct process_info *info)
+{
+	ssize_t i, n = read_proc_file(info->proc->pid, "cmdline", info->cmdline, sizeof(info->cmdline));
+	/* the arguments are separated by null characters */
+	for (i = 0; i < n; i++)
+	{
+		if (info->cmdline[i] == '\0')
+			info->cmdline[i] = ' ';
+	}
+	while (n > 0 && info->cmdline[n - 1] == ' ')
+		info->cmdline[--n] = '\0';
+	if (n < 0)
+		info->cmdline[0] = '\0';
+}
+
+static void read_uid(struct process_info *info)
+{
+	/* the owner of the directory is the effective uid, the real one is
+	the first of the Uid line */
+	char status[2048];
+	const char *line;
+	info->uid = -1;
+	if (read_proc_file(info->proc->pid, "status", status, sizeof(status)) < 0 ||
+		(line = strstr(status, "\nUid:")) == NULL ||
+		sscanf(line + 1, "Uid: %ld", &info->uid) != 1)
+		info->uid = -1;
+}
+
+#else
+
+static void read_exe(struct process_info *info)
+{
+	strcpy(info->exe, info->proc->command);
+}
+
+static void read_comm(struct process_info *info)
+{
+	char command[PATH_MAX + 1];
+	strcpy(command, info->proc->command);
+	strncpy(info->comm, basename(command), COMM_LEN - 1);
+	info->comm[COMM_LEN - 1] = '\0';
+}
+
+static void read_cmdline(struct process_info *info)
+{
+	strncpy(info->cmdline, info->proc->command, sizeof(info->cmdline) - 1);
+	info->cmdline[sizeof(info->cmdline) - 1] = '\0';
+}
+
+static void read_uid(struct process_info *info)
+{
+	/* unknown */
+	info->uid = -1;
+}
+
+#endif
+
+static int match_rule(const struct rule *rule, struct process_info *info)
+{
+	const char *exe;
+	if (rule->exe != NULL)
+	{
+		if (!info->have_exe)
+		{
+			read_exe(info);
+			info->have_exe = 1;
+		}
+		/* a file name matches the executables of any directory */
+		if (strchr(rule->exe, '/') != NULL)
+			exe = info->exe;
+		else
+			exe = strrchr(info->exe, '/') != NULL ? strrchr(info->exe, '/') + 1 : info->exe;
+		if (strcmp(exe, rule->exe) != 0)
+			return 0;
+	}
+	if (rule->comm != NULL)
+	{
+		if (!info->have_comm)
+		{
+			read_comm(info);
+			info->have_comm = 1;
+		}
+		/* the kernel truncates the names */
+		if (strncmp(info->comm, rule->comm, COMM_LEN - 1) != 0 ||
+			(strlen(rule->comm) < COMM_LEN - 1 && strcmp(info->comm, rule->comm) != 0))
+			return 0;
+	}
+	if (rule->has_cmdline)
+	{
+		if (!info->have_cmdline)
+		{
+			read_cmdline(info);
+			info->have_cmdline = 1;
+		}
+		if (regexec(&rule->cmdline, info->cmdline, 0, NULL, 0) != 0)
+			return 0;
+	}
+	if (rule->uid >= 0)
+	{
+		if (!info->have_uid)
+		{
+			read_uid(info);
+			info->have_uid = 1;
+		}
+		if (info->uid != rule->uid)
+			return 0;
+	}
+	return 1;
+}
+
+/* look for the first rule matched by a process
+return:  the rule, NULL if there is none */
+const struct rule *match_rules(const struct rule_set *rules, const struct process *proc)
+{
+	struct process_info info;
+	int i;
+	info.proc = proc;
+	info.have_exe = info.have_comm = info.have_cmdline = info.have_uid = 0;
+	for (i = 0; i < rules->count; i++)
+	{
+		if (match_rule(&rules->rules[i], &info))
+			return &rules->rules[i];
+	}
+	return NULL;
+}
+
+void free_rules(struct rule_set *rules)
+{
+	while (rules->count > 0)
+		free_rule(&rules->rules[--rules->count]);
+	free(rules->rules);
+	rules->rules = NULL;
+	free(rules->path);
+	rules->path = NULL;
+	if (rules->watch_fd >= 0)
+		close(rules->watch_fd);
+	rules->watch_fd = -1;
+}
@@ -0,0 +1,77 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __RULES_H
+#define __RULES_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <regex.h>
+
+#include "process_iterator.h"
+
+/* rules file of the daemon mode, one rule per line:
+	[exe=FILE] [comm=NAME] [cmdline=REGEX] [uid=USER] limit=N [include-children]
+a process matches a rule if it matches all its patterns, the first rule
+matched applies. values containing spaces are written between double
+quotes, and # starts a comment */
+
+struct rule
+{
+	/* path name of the executable, or its file name, NULL if any */
+	char *exe;
+	/* command name (as in /proc/PID/comm), NULL if any */
+	char *comm;
+	/* extended regular expression searched in the command line */
+	regex_t cmdline;
+	int has_cmdline;
+	/* real uid of the process, -1 if any */
+	long uid;
+	/* cpu allowed to each matching process (range 0-NCPU) */
+	double limit;
+	int include_children;
+	/* line of the rule in the file */
+	int line;
+};
+
+struct rule_set
+{
+	struct rule *rules;
+	int count;
+	/* file the rules are loaded from */
+	char *path;
+	/* inotify descriptor watching the file, -1 if its changes are
+	detected through its modification time */
+	int watch_fd;
+	time_t mtime;
+};
+
+int load_rules(struct rule_set *rules, const char *path, int ncpu);
+
+int rules_changed(struct rule_set *rules);
+
+int reload_rules(struct rule_set *rules, int ncpu);
+
+const struct rule *match_rules(const struct rule_set *rules, const struct process *proc);
+
+void free_rules(struct rule_set *rules);
+
+#endif
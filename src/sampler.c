@@ -0,0 +1,448 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sampler.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+/* IORING_OP_READ and IORING_REGISTER_PROBE came with it */
+#ifdef IO_URING_OP_SUPPORTED
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <limits.h>
+
+#define ring_ptr(base, offset) ((unsigned *)((char *)(base) + (offset)))
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* check that the kernel can read files through the ring */
+static int probe_read(int ring_fd)
+{
+	struct io_uring_probe *probe;
+	int ret = 0;
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = (struct io_uring_probe *)calloc(1, size);
+	if (probe == NULL)
+	{
+		exit(-1);
+	}
+	if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+		probe->last_op >= IORING_OP_READ &&
+		(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED))
+		ret = 1;
+	free(probe);
+	return ret;
+}
+
+static void unmap_rings(struct stat_sampler *sampler)
+{
+	if (sampler->sqes != NULL && sampler->sqes != MAP_FAILED)
+		munmap(sampler->sqes, sampler->sqes_size);
+	if (sampler->cq_ring != NULL && sampler->cq_ring != MAP_FAILED &&
+		sampler->cq_ring != sampler->sq_ring)
+		munmap(sampler->cq_ring, sampler->cq_ring_size);
+	if (sampler->sq_ring != NULL && sampler->sq_ring != MAP_FAILED)
+		munmap(sampler->sq_ring, sampler->sq_ring_size);
+	sampler->sq_ring = sampler->cq_ring = sampler->sqes = NULL;
+}
+
+static int setup_ring(struct stat_sampler *sampler)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	if ((sampler->ring_fd = io_uring_setup(SAMPLER_ENTRIES, &params)) < 0)
+		return -1;
+	if (!probe_read(sampler->ring_fd))
+		return -1;
+
+	sampler->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	sampler->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sampler->sq_ring_size = sampler->cq_ring_size = MAX(sampler->sq_ring_size, sampler->cq_ring_size);
+	sampler->sq_ring = mmap(NULL, sampler->sq_ring_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, sampler->ring_fd, IORING_OFF_SQ_RING);
+	if (sampler->sq_ring == MAP_FAILED)
+		return -1;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sampler->cq_ring = sampler->sq_ring;
+	else
+		sampler->cq_ring = mmap(NULL, sampler->cq_ring_size, PROT_READ | PROT_WRITE,
+								MAP_SHARED | MAP_POPULATE, sampler->ring_fd, IORING_OFF_CQ_RING);
+	if (sampler->cq_ring == MAP_FAILED)
+		return -1;
+	sampler->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	sampler->sqes = mmap(NULL, sampler->sqes_size, PROT_READ | PROT_WRITE,
+						 MAP_SHARED | MAP_POPULATE, sampler->ring_fd, IORING_OFF_SQES);
+	if (sampler->sqes == MAP_FAILED)
+		return -1;
+
+	sampler->sq_head = ring_ptr(sampler->sq_ring, params.sq_off.head);
+	sampler->sq_tail = ring_ptr(sampler->sq_ring, params.sq_off.tail);
+	sampler->sq_mask = ring_ptr(sampler->sq_ring, params.sq_off.ring_mask);
+	sampler->sq_array = ring_ptr(sampler->sq_ring, params.sq_off.array);
+	sampler->cq_head = ring_ptr(sampler->cq_ring, params.cq_off.head);
+	sampler->cq_tail = ring_ptr(sampler->cq_ring, params.cq_off.tail);
+	sampler->cq_mask = ring_ptr(sampler->cq_ring, params.cq_off.ring_mask);
+	sampler->cqes = (char *)sampler->cq_ring + params.cq_off.cqes;
+	return 0;
+}
+
+/* prepare the sampler, probing io_uring
+return:  0 if io_uring can be used, -1 otherwise */
+int init_stat_sampler(struct stat_sampler *sampler)
+{
+	struct rlimit files;
+	memset(sampler, 0, sizeof(struct stat_sampler));
+	sampler->max_files = INT_MAX;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY)
+		sampler->max_files = (int)MIN(files.rlim_cur, (rlim_t)INT_MAX) - SAMPLER_FD_RESERVE;
+	if (setup_ring(sampler) != 0)
+	{
+		unmap_rings(sampler);
+		if (sampler->ring_fd >= 0)
+			close(sampler->ring_fd);
+		sampler->ring_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* member to read, the pid comes first to be sorted and searched like a pid */
+struct member
+{
+	pid_t pid;
+	int index;
+};
+
+static int compare_pid(const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int open_stat_file(pid_t pid)
+{
+	char statfile[PATH_MAX + 32];
+	sprintf(statfile, "%s/%ld/stat", get_procfs_root(), (long)pid);
+	return open(statfile, O_RDONLY | O_CLOEXEC);
+}
+
+/* keep a descriptor open for each member, and only for the members
+members: the members sorted by pid
+return:  1 if the descriptors changed, 0 otherwise */
+static int update_files(struct stat_sampler *sampler, const struct member *members, int count)
+{
+	pid_t *pids;
+	int *fds;
+	int i, changed = count != sampler->count, opened = 0;
+
+	pids = (pid_t *)malloc(count * sizeof(pid_t) + 1);
+	fds = (int *)malloc(count * sizeof(int) + 1);
+	if (pids == NULL || fds == NULL)
+	{
+		exit(-1);
+	}
+	for (i = 0; i < count; i++)
+		pids[i] = members[i].pid;
+	for (i = 0; i < count; i++)
+	{
+		pid_t *old = sampler->count > 0 ? (pid_t *)bsearch(&pids[i], sampler->pids, sampler->count, sizeof(pid_t), compare_pid) : NULL;
+		if (old != NULL && sampler->fds[old - sampler->pids] >= 0)
+		{
+			fds[i] = sampler->fds[old - sampler->pids];
+			sampler->fds[old - sampler->pids] = -1;
+			opened++;
+			continue;
+		}
+		/* new member, or reading its file failed last time, it is left to
+		the caller beyond the limit of descriptors */
+		fds[i] = opened < sampler->max_files ? open_stat_file(pids[i]) : -1;
+		if (fds[i] >= 0)
+			opened++;
+		changed = 1;
+	}
+	/* the members which left the group */
+	for (i = 0; i < sampler->count; i++)
+	{
+		if (sampler->fds[i] >= 0)
+		{
+			close(sampler->fds[i]);
+			changed = 1;
+		}
+	}
+	free(sampler->pids);
+	free(sampler->fds);
+	sampler->pids = pids;
+	sampler->fds = fds;
+	sampler->count = count;
+	if (count > sampler->capacity)
+	{
+		free(sampler->bufs);
+		sampler->bufs = (char *)malloc(count * STAT_BUF_SIZE);
+		if (sampler->bufs == NULL)
+		{
+			exit(-1);
+		}
+		sampler->capacity = count;
+	}
+	return changed;
+}
+
+/* read the cpu time (in ms) out of the content of a stat file
+with_children: count the time of the children waited for
+pgid: set to the process group id */
+static double parse_cputime(char *buf, int with_children, pid_t *pgid)
+{
+	char *p = strrchr(buf, ')');
+	char state;
+	long pgrp;
+	double utime, stime, cutime, cstime;
+	if (p == NULL ||
+		sscanf(p + 1, " %c %*d %ld %*d %*d %*d %*d %*d %*d %*d %*d %lf %lf %lf %lf",
+			   &state, &pgrp, &utime, &stime, &cutime, &cstime) != 6 ||
+		strchr("ZXx", state) != NULL)
+		return -1;
+	*pgid = (pid_t)pgrp;
+	if (with_children)
+		utime += cutime + cstime;
+	return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+/* read the stat files of a batch of members through the ring
+return:  0 on success, -1 if the ring failed */
+static int submit_batch(struct stat_sampler *sampler, int first, int count)
+{
+	struct io_uring_sqe *sqes = (struct io_uring_sqe *)sampler->sqes;
+	struct io_uring_cqe *cqes = (struct io_uring_cqe *)sampler->cqes;
+	unsigned tail = *sampler->sq_tail;
+	unsigned head;
+	int i, submitted = 0, completed = 0;
+
+	for (i = first; i < first + count; i++)
+	{
+		unsigned index = tail & *sampler->sq_mask;
+		struct io_uring_sqe *sqe = &sqes[index];
+		if (sampler->fds[i] < 0)
+			continue;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		if (sampler->fixed)
+		{
+			sqe->flags = IOSQE_FIXED_FILE;
+			sqe->fd = i;
+		}
+		else
+		{
+			sqe->fd = sampler->fds[i];
+		}
+		sqe->addr = (unsigned long)(sampler->bufs + (size_t)i * STAT_BUF_SIZE);
+		sqe->len = STAT_BUF_SIZE - 1;
+		sqe->off = 0;
+		sqe->user_data = i;
+		sampler->sq_array[index] = index;
+		tail++;
+		submitted++;
+	}
+	if (submitted == 0)
+		return 0;
+	__atomic_store_n(sampler->sq_tail, tail, __ATOMIC_RELEASE);
+
+	/* the buffers are written until the last read completes, a signal
+	must not end the wait before */
+	while (1)
+	{
+		head = *sampler->cq_head;
+		while (head != __atomic_load_n(sampler->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe *cqe = &cqes[head & *sampler->cq_mask];
+			char *buf = sampler->bufs + (size_t)cqe->user_data * STAT_BUF_SIZE;
+			if (cqe->res > 0)
+			{
+				buf[cqe->res] = '\0';
+			}
+			else
+			{
+				/* the process is gone, or the pid was recycled */
+				buf[0] = '\0';
+			}
+			head++;
+			completed++;
+		}
+		__atomic_store_n(sampler->cq_head, head, __ATOMIC_RELEASE);
+		if (completed == submitted)
+			return 0;
+		/* the entries not consumed yet are submitted again */
+		if (io_uring_enter(sampler->ring_fd, tail - __atomic_load_n(sampler->sq_head, __ATOMIC_ACQUIRE),
+						   submitted - completed, IORING_ENTER_GETEVENTS) < 0 &&
+			errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return -1;
+	}
+}
+
+/* read the cpu time of the processes with as few system calls as possible
+cputimes: set to the cpu time (in ms) of each process, left untouched for
+		  the processes which could not be read
+with_children: nonzero for the processes whose time includes the one of
+			   the children they waited for, NULL for none
+pgids: set to the process group id of the processes read, NULL for none
+return:  0 on success, -1 if the sampler cannot be used */
+int sample_cputimes(struct stat_sampler *sampler, struct process **procs, int count,
+					double *cputimes, const int *with_children, pid_t *pgids)
+{
+	struct member *members;
+	int i, ret = 0;
+	if (sampler->ring_fd < 0)
+		return -1;
+	members = (struct member *)malloc(count * sizeof(struct member) + 1);
+	if (members == NULL)
+	{
+		exit(-1);
+	}
+	for (i = 0; i < count; i++)
+	{
+		members[i].pid = procs[i]->pid;
+		members[i].index = i;
+	}
+	qsort(members, count, sizeof(struct member), compare_pid);
+	if (update_files(sampler, members, count))
+	{
+		if (sampler->fixed)
+			io_uring_register(sampler->ring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+		sampler->fixed = count > 0 &&
+						 io_uring_register(sampler->ring_fd, IORING_REGISTER_FILES, sampler->fds, count) == 0;
+	}
+	for (i = 0; i < count; i++)
+		sampler->bufs[(size_t)i * STAT_BUF_SIZE] = '\0';
+	for (i = 0; i < count && ret == 0; i += SAMPLER_ENTRIES)
+		ret = submit_batch(sampler, i, MIN(SAMPLER_ENTRIES, count - i));
+	for (i = 0; i < count && ret == 0; i++)
+	{
+		pid_t pgid;
+		double cputime = parse_cputime(sampler->bufs + (size_t)i * STAT_BUF_SIZE,
+									   with_children != NULL && with_children[members[i].index],
+									   &pgid);
+		if (cputime >= 0)
+		{
+			cputimes[members[i].index] = cputime;
+			if (pgids != NULL)
+				pgids[members[i].index] = pgid;
+		}
+		else if (sampler->fds[i] >= 0)
+		{
+			/* open it again at the next sample */
+			close(sampler->fds[i]);
+			sampler->fds[i] = -1;
+		}
+	}
+	free(members);
+	if (ret != 0)
+	{
+		/* some reads may still be in flight, the ring is given up and
+		the buffers they write to are never freed */
+		sampler->bufs = NULL;
+		sampler->capacity = 0;
+		close_stat_sampler(sampler);
+	}
+	return ret;
+}
+
+void close_stat_sampler(struct stat_sampler *sampler)
+{
+	int i;
+	for (i = 0; i < sampler->count; i++)
+	{
+		if (sampler->fds[i] >= 0)
+			close(sampler->fds[i]);
+	}
+	free(sampler->pids);
+	free(sampler->fds);
+	free(sampler->bufs);
+	sampler->pids = NULL;
+	sampler->fds = NULL;
+	sampler->bufs = NULL;
+	sampler->count = sampler->capacity = 0;
+	if (sampler->ring_fd < 0)
+		return;
+	unmap_rings(sampler);
+	close(sampler->ring_fd);
+	sampler->ring_fd = -1;
+}
+
+#else
+
+int init_stat_sampler(struct stat_sampler *sampler)
+{
+	memset(sampler, 0, sizeof(struct stat_sampler));
+	sampler->ring_fd = -1;
+	return -1;
+}
+
+int sample_cputimes(struct stat_sampler *sampler, struct process **procs, int count,
+					double *cputimes, const int *with_children, pid_t *pgids)
+{
+	(void)sampler;
+	(void)procs;
+	(void)count;
+	(void)cputimes;
+	(void)with_children;
+	(void)pgids;
+	return -1;
+}
+
+void close_stat_sampler(struct stat_sampler *sampler)
+{
+	(void)sampler;
+}
+
+#endif
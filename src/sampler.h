@@ -0,0 +1,70 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __SAMPLER_H
+#define __SAMPLER_H
+
+#include <sys/types.h>
+
+#include "process_iterator.h"
+
+/* submission queue entries of the ring, larger batches take several calls */
+#define SAMPLER_ENTRIES 256
+/* longest stat file expected */
+#define STAT_BUF_SIZE 512
+/* descriptors left to the rest of the program, the members beyond the
+limit are read one at a time by the caller */
+#define SAMPLER_FD_RESERVE 64
+
+/* reads the cpu time of all the members at once with io_uring
+it keeps a descriptor of /proc/PID/stat open for each member, registered
+in the ring as fixed files */
+struct stat_sampler
+{
+	/* io_uring descriptor, -1 if io_uring is not available */
+	int ring_fd;
+	/* memory shared with the kernel */
+	void *sq_ring, *cq_ring, *sqes;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	void *cqes;
+	/* pids of the members (sorted) and their descriptors (-1 if closed) */
+	pid_t *pids;
+	int *fds;
+	int count;
+	int capacity;
+	/* most descriptors kept open */
+	int max_files;
+	/* 1 if fds is registered in the ring */
+	int fixed;
+	/* one buffer per member */
+	char *bufs;
+};
+
+int init_stat_sampler(struct stat_sampler *sampler);
+
+int sample_cputimes(struct stat_sampler *sampler, struct process **procs, int count,
+					double *cputimes, const int *with_children, pid_t *pgids);
+
+void close_stat_sampler(struct stat_sampler *sampler);
+
+#endif
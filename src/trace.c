@@ -0,0 +1,191 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+#include "util.h"
+#include "list.h"
+
+/* the cycles are written in a large buffer, to keep the writes out of the
+control loop most of the time */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+static void put_int(FILE *file, long value)
+{
+	int v = (int)value;
+	fwrite(&v, sizeof(v), 1, file);
+}
+
+static void put_double(FILE *file, double value)
+{
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static int get_int(FILE *file, int *value)
+{
+	return fread(value, sizeof(*value), 1, file) == 1 ? 0 : -1;
+}
+
+static int get_double(FILE *file, double *value)
+{
+	return fread(value, sizeof(*value), 1, file) == 1 ? 0 : -1;
+}
+
+/* create the trace at path and write its header
+return:  0 on success, -1 on error (errno is set) */
+int open_trace_writer(struct trace *trace, const char *path, const struct trace_header *header)
+{
+	memset(trace, 0, sizeof(struct trace));
+	if ((trace->file = fopen_cloexec(path, "wb")) == NULL)
+		return -1;
+	trace->buffer = (char *)malloc(TRACE_BUFFER_SIZE);
+	if (trace->buffer == NULL)
+	{
+		exit(-1);
+	}
+	setvbuf(trace->file, trace->buffer, _IOFBF, TRACE_BUFFER_SIZE);
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace->file);
+	put_int(trace->file, TRACE_BYTE_ORDER);
+	put_int(trace->file, TRACE_VERSION);
+	put_double(trace->file, header->limit);
+	put_int(trace->file, header->ncpu);
+	put_int(trace->file, header->time_slot);
+	put_int(trace->file, header->flags);
+	/* forked children must not write the header again */
+	if (fflush(trace->file) != 0)
+	{
+		int err = errno;
+		close_trace(trace);
+		errno = err;
+		return -1;
+	}
+	get_time(&trace->start);
+	return 0;
+}
+
+/* append a cycle, the members are the ones of the process group */
+void write_trace_cycle(struct trace *trace, struct process_group *pgroup, const struct trace_cycle *cycle)
+{
+	struct list_node *node;
+	struct timespec now;
+	if (trace->file == NULL)
+		return;
+	get_time(&now);
+	put_double(trace->file, timediff_in_ms(&now, &trace->start) / 1000);
+	put_double(trace->file, pgroup->sample_interval);
+	put_double(trace->file, cycle->limit);
+	put_double(trace->file, cycle->pcpu);
+	put_double(trace->file, cycle->workingrate);
+	put_double(trace->file, cycle->twork);
+	put_double(trace->file, cycle->tsleep);
+	put_int(trace->file, pgroup->proclist->count);
+	for (node = pgroup->proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		put_int(trace->file, p->pid);
+		put_int(trace->file, p->ppid);
+		put_double(trace->file, p->cputime);
+		put_double(trace->file, pgroup->sample_interval > 0 ? p->used : -1);
+	}
+}
+
+/* open the trace at path and read its header
+return:  0 on success, -1 on error (errno is set) */
+int open_trace_reader(struct trace *trace, const char *path, struct trace_header *header)
+{
+	char magic[sizeof(TRACE_MAGIC)];
+	int byte_order, version;
+	memset(trace, 0, sizeof(struct trace));
+	if ((trace->file = fopen_cloexec(path, "rb")) == NULL)
+		return -1;
+	if (fread(magic, 1, strlen(TRACE_MAGIC), trace->file) != strlen(TRACE_MAGIC) ||
+		memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0 ||
+		get_int(trace->file, &byte_order) != 0 || byte_order != TRACE_BYTE_ORDER ||
+		get_int(trace->file, &version) != 0 || version != TRACE_VERSION ||
+		get_double(trace->file, &header->limit) != 0 ||
+		get_int(trace->file, &header->ncpu) != 0 ||
+		get_int(trace->file, &header->time_slot) != 0 ||
+		get_int(trace->file, &header->flags) != 0)
+	{
+		close_trace(trace);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* read the next cycle, cycle->members must be NULL or allocated with malloc
+return:  1 if a cycle was read
+		 0 at the end of the trace
+		 -1 if the trace is truncated or corrupted */
+int read_trace_cycle(struct trace *trace, struct trace_cycle *cycle)
+{
+	int i;
+	if (get_double(trace->file, &cycle->time) != 0)
+		return 0;
+	if (get_double(trace->file, &cycle->interval) != 0 ||
+		get_double(trace->file, &cycle->limit) != 0 ||
+		get_double(trace->file, &cycle->pcpu) != 0 ||
+		get_double(trace->file, &cycle->workingrate) != 0 ||
+		get_double(trace->file, &cycle->twork) != 0 ||
+		get_double(trace->file, &cycle->tsleep) != 0 ||
+		get_int(trace->file, &cycle->count) != 0 || cycle->count < 0)
+		return -1;
+	if (cycle->count > cycle->size)
+	{
+		cycle->size = cycle->count;
+		cycle->members = (struct trace_member *)realloc(cycle->members, cycle->size * sizeof(struct trace_member));
+		if (cycle->members == NULL)
+		{
+			exit(-1);
+		}
+	}
+	for (i = 0; i < cycle->count; i++)
+	{
+		int pid, ppid;
+		if (get_int(trace->file, &pid) != 0 ||
+			get_int(trace->file, &ppid) != 0 ||
+			get_double(trace->file, &cycle->members[i].cputime) != 0 ||
+			get_double(trace->file, &cycle->members[i].used) != 0)
+			return -1;
+		cycle->members[i].pid = (pid_t)pid;
+		cycle->members[i].ppid = (pid_t)ppid;
+	}
+	return 1;
+}
+
+void close_trace(struct trace *trace)
+{
+	if (trace->file == NULL)
+		return;
+	fclose(trace->file);
+	trace->file = NULL;
+	free(trace->buffer);
+	trace->buffer = NULL;
+}
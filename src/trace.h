@@ -0,0 +1,110 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "process_group.h"
+
+/* binary trace of the control loop, for offline replays
+the trace starts with a header:
+	magic (8 bytes), byte order mark (int32), version (int32),
+	limit (double), ncpu (int32), time slot in us (int32), flags (int32)
+then for every cycle:
+	time since the start in s (double), sampling interval in ms (double),
+	limit, pcpu, workingrate (double),
+	work and sleep time in us (double), members (int32),
+	and for every member: pid, ppid (int32), cputime and cputime
+	accounted in the cycle in ms (double)
+all the values are in the byte order of the writer
+the budget tree of the nested groups is not recorded: such traces only
+tell the usage of the whole group */
+#define TRACE_MAGIC "CPULTRCE"
+#define TRACE_BYTE_ORDER 0x01020304
+#define TRACE_VERSION 2
+
+/* flags of the header: the limit was split among nested groups */
+#define TRACE_NESTED_GROUPS 0x1
+
+struct trace_header
+{
+	/* limit at the start (range 0-NCPU) */
+	double limit;
+	int ncpu;
+	/* length of a control slot (in us) */
+	int time_slot;
+	int flags;
+};
+
+struct trace_member
+{
+	pid_t pid;
+	pid_t ppid;
+	/* cputime read at the start of the cycle (in ms) */
+	double cputime;
+	/* cputime accounted in the cycle, children debt paid (in ms), -1 if
+	the member was not sampled */
+	double used;
+};
+
+struct trace_cycle
+{
+	/* time since the start of the trace (in s) */
+	double time;
+	/* time since the previous sample of the cputimes (in ms), 0 if the
+	cputimes were not sampled in this cycle */
+	double interval;
+	double limit;
+	/* estimated cpu usage of the members (range 0-NCPU) */
+	double pcpu;
+	double workingrate;
+	/* work and sleep time of the slot (in us) */
+	double twork;
+	double tsleep;
+	int count;
+	/* members read by read_trace_cycle(), size is the room allocated */
+	struct trace_member *members;
+	int size;
+};
+
+struct trace
+{
+	FILE *file;
+	/* buffer of the writes */
+	char *buffer;
+	struct timespec start;
+};
+
+int open_trace_writer(struct trace *trace, const char *path, const struct trace_header *header);
+
+void write_trace_cycle(struct trace *trace, struct process_group *pgroup, const struct trace_cycle *cycle);
+
+int open_trace_reader(struct trace *trace, const char *path, struct trace_header *header);
+
+int read_trace_cycle(struct trace *trace, struct trace_cycle *cycle);
+
+void close_trace(struct trace *trace);
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "util.h"
+
+/* fallback of get_time() for systems without clock_gettime() */
+int __get_time(struct timespec *ts)
+{
+	struct timeval tv;
+	if (gettimeofday(&tv, NULL))
+	{
+		return -1;
+	}
+	ts->tv_sec = tv.tv_sec;
+	ts->tv_nsec = tv.tv_usec * 1000L;
+	return 0;
+}
+
+/* open a stream which is not inherited by the programs executed
+return:  the stream, NULL on error (errno is set) */
+FILE *fopen_cloexec(const char *path, const char *mode)
+{
+	FILE *stream = fopen(path, mode);
+	if (stream != NULL && fcntl(fileno(stream), F_SETFD, FD_CLOEXEC) != 0)
+	{
+		int err = errno;
+		fclose(stream);
+		errno = err;
+		return NULL;
+	}
+	return stream;
+}
@@ -0,0 +1,76 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __UTIL_H
+#define __UTIL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+int __get_time(struct timespec *ts);
+
+/* inline int get_time(struct timespec *ts); */
+#ifndef get_time
+#if _POSIX_TIMERS > 0
+#if defined(CLOCK_TAI)
+#define get_time(ts) clock_gettime(CLOCK_TAI, (ts))
+#elif defined(CLOCK_MONOTONIC)
+#define get_time(ts) clock_gettime(CLOCK_MONOTONIC, (ts))
+#endif
+#endif
+#endif
+#ifndef get_time
+#define get_time(ts) __get_time(ts)
+#endif
+
+/* returns t1-t2 in millisecond */
+/* static inline double timediff_in_ms(const struct timespec *t1, const struct timespec *t2) */
+#define timediff_in_ms(t1, t2) \
+	(((t1)->tv_sec - (t2)->tv_sec) * 1e3 + ((t1)->tv_nsec - (t2)->tv_nsec) / 1e6)
+
+/* inline void nsec2timespec(double nsec, struct timespec *t); */
+#ifndef nsec2timespec
+#define nsec2timespec(nsec, t)                             \
+	do                                                     \
+	{                                                      \
+		(t)->tv_sec = (time_t)((nsec) / 1e9);              \
+		(t)->tv_nsec = (long)((nsec) - (t)->tv_sec * 1e9); \
+	} while (0)
+#endif
+
+/* inline int sleep_timespec(struct timespec *t); */
+#ifndef sleep_timespec
+#if defined(__linux__) && _POSIX_C_SOURCE >= 200112L && defined(CLOCK_TAI)
+#define sleep_timespec(t) clock_nanosleep(CLOCK_TAI, 0, (t), NULL)
+#else
+#define sleep_timespec(t) nanosleep((t), NULL)
+#endif
+#endif
+
+FILE *fopen_cloexec(const char *path, const char *mode);
+
+#endif
@@ -1,16 +1,68 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "busy.h"
 
 #ifndef __GNUC__
 #define __attribute__(attr)
 #endif
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 #define MAX_PRIORITY -20
 
+/* shape of the demand of the workers over time */
+enum demand_mode
+{
+	FLAT,
+	SQUARE,
+	SINE,
+	WALK
+};
+
+struct workload
+{
+	/* worker threads of every process */
+	int threads;
+	enum demand_mode mode;
+	/* highest fraction of the time a worker is busy */
+	double duty;
+	/* the duty cycle is applied over periods of this length (in ms) */
+	double period;
+	/* period of the square and sine waves, step of the random walk (in ms) */
+	double wave;
+	/* short-lived children forked per second, and their lifetime (in ms) */
+	double fork_rate;
+	double lifetime;
+	/* tree of processes below the first one */
+	int depth;
+	int fanout;
+	/* the workload stops at this time (in ms), never if 0 */
+	double end;
+	unsigned int seed;
+};
+
+static struct workload workload;
+static struct busy_report *report = NULL;
+
 static void increase_priority(void)
 {
 	/* find the best available nice value */
@@ -41,31 +93,306 @@ static int get_ncpu(void)
 	return ncpu;
 }
 
-static void *loop(void *param __attribute__((unused)))
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* cpu time used by the calling thread (in ms), 0 if unknown */
+static double thread_cputime(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec t;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) == 0)
+		return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+#endif
+	return 0;
+}
+
+static void sleep_ms(double ms)
 {
-	while (1)
+	struct timespec t;
+	if (ms <= 0)
+		return;
+	t.tv_sec = (time_t)(ms / 1000);
+	t.tv_nsec = (long)((ms - t.tv_sec * 1000.0) * 1e6);
+	while (nanosleep(&t, &t) != 0 && errno == EINTR)
 		;
-	return NULL;
 }
 
-int main(int argc, char *argv[])
+static int expired(void)
 {
+	return workload.end > 0 && now_ms() >= workload.end;
+}
 
-	int i = 0;
-	int num_threads = get_ncpu();
-	increase_priority();
-	if (argc == 2)
-		num_threads = atoi(argv[1]);
-	for (i = 0; i < num_threads - 1; i++)
+/* take a slot of the report, NULL if there is no report */
+static struct busy_slot *take_slot(void)
+{
+	long n;
+	struct busy_slot *slot;
+	if (report == NULL)
+		return NULL;
+#ifdef __GNUC__
+	n = __sync_fetch_and_add(&report->next_slot, 1);
+#else
+	n = report->next_slot++;
+#endif
+	slot = &report->slots[n % BUSY_SLOTS];
+	slot->demand = slot->cputime = 0;
+	slot->pid = (long)getpid();
+	return slot;
+}
+
+/* fraction of the time a worker wants to be busy at time t (in ms) */
+static double demand_at(double t, double *walk, unsigned int *seed)
+{
+	double phase = fmod(t, workload.wave) / workload.wave;
+	switch (workload.mode)
+	{
+	case SQUARE:
+		return phase < 0.5 ? workload.duty : 0;
+	case SINE:
+		return workload.duty * (1 + sin(2 * M_PI * phase)) / 2;
+	case WALK:
+		/* a step of up to 10% of duty every wave, the level stays for the wave */
+		if (phase * workload.wave < workload.period)
+		{
+			*walk += workload.duty * ((double)rand_r(seed) / RAND_MAX - 0.5) / 5;
+			*walk = *walk < 0 ? 0 : (*walk > workload.duty ? workload.duty : *walk);
+		}
+		return *walk;
+	default:
+		return workload.duty;
+	}
+}
+
+/* busy for the demanded fraction of every period, reporting the demand
+and the cpu time it actually got */
+static void *worker(void *param)
+{
+	struct busy_slot *slot = (struct busy_slot *)param;
+	double walk = workload.duty / 2;
+	/* every worker walks its own way */
+	unsigned int seed = workload.seed + (unsigned int)(slot != NULL ? slot - report->slots : 0);
+	while (!expired())
+	{
+		double start = now_ms(), end, level;
+		double cputime = thread_cputime();
+		level = workload.duty >= 1 && workload.mode == FLAT ? 1 : demand_at(start, &walk, &seed);
+		end = start + level * workload.period;
+		while (now_ms() < end)
+			;
+		if (level < 1)
+			sleep_ms(start + workload.period - now_ms());
+		if (slot != NULL)
+		{
+			/* the time spent stopped counts as demand too */
+			slot->demand += level * (now_ms() - start);
+			slot->cputime += thread_cputime() - cputime;
+		}
+	}
+	return NULL;
+}
+
+/* start the worker threads of the process, the calling thread is the last
+worker if it has nothing else to do */
+static void run_workers(int keep_caller)
+{
+	int i;
+	for (i = 0; i < workload.threads - keep_caller; i++)
 	{
 		pthread_t thread;
 		int ret;
-		if ((ret = pthread_create(&thread, NULL, loop, NULL)) != 0)
+		if ((ret = pthread_create(&thread, NULL, worker, take_slot())) != 0)
 		{
 			printf("pthread_create() failed. Error code %d\n", ret);
 			exit(1);
 		}
 	}
-	loop(NULL);
+	if (keep_caller)
+		worker(take_slot());
+}
+
+static void reap_children(int options)
+{
+	while (waitpid(-1, NULL, options) > 0 || (errno == EINTR && options == 0))
+		;
+}
+
+/* process of the tree at the given depth, and the subtree below it */
+static void run_node(int depth)
+{
+	int i;
+	for (i = 0; depth < workload.depth && i < workload.fanout; i++)
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0)
+		{
+			run_node(depth + 1);
+			exit(0);
+		}
+	}
+	if (workload.fork_rate <= 0 || depth > 0)
+	{
+		run_workers(1);
+		reap_children(0);
+		return;
+	}
+	/* the first process forks the short-lived children */
+	run_workers(0);
+	while (!expired())
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0)
+		{
+			if (workload.end <= 0 || now_ms() + workload.lifetime < workload.end)
+				workload.end = now_ms() + workload.lifetime;
+			workload.fork_rate = 0;
+			run_workers(1);
+			exit(0);
+		}
+		sleep_ms(1000 / workload.fork_rate);
+		reap_children(WNOHANG);
+	}
+	reap_children(0);
+}
+
+static int open_report(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(struct busy_report)) != 0)
+		return -1;
+	report = (struct busy_report *)mmap(NULL, sizeof(struct busy_report), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (report == MAP_FAILED)
+	{
+		report = NULL;
+		return -1;
+	}
+	memset(report, 0, sizeof(struct busy_report));
+	report->magic = BUSY_MAGIC;
+	return 0;
+}
+
+static void print_usage(FILE *stream, const char *name)
+{
+	fprintf(stream, "Usage: %s [THREADS]\n", name);
+	fprintf(stream, "       %s [OPTIONS...]\n", name);
+	fprintf(stream, "   OPTIONS\n");
+	fprintf(stream, "      -t THREADS      worker threads of every process (default: number of cpus)\n");
+	fprintf(stream, "      -d DUTY         fraction of the time the workers are busy, 0-1 (default: 1)\n");
+	fprintf(stream, "      -p PERIOD       period of the duty cycle in ms (default: 100)\n");
+	fprintf(stream, "      -m MODE         shape of the demand over time: flat, square, sine or walk\n");
+	fprintf(stream, "      -w WAVE         period of the square and sine waves, step of the walk in ms\n");
+	fprintf(stream, "                      (default: 10000)\n");
+	fprintf(stream, "      -f RATE         fork RATE short-lived children per second\n");
+	fprintf(stream, "      -l LIFETIME     lifetime of the short-lived children in ms (default: 500)\n");
+	fprintf(stream, "      -D DEPTH        run a tree of processes DEPTH levels deep\n");
+	fprintf(stream, "      -F FANOUT       children of every process of the tree (default: 1)\n");
+	fprintf(stream, "      -T SECONDS      stop after SECONDS (default: never)\n");
+	fprintf(stream, "      -r FILE         report the demand and the cpu time of every worker in FILE\n");
+	fprintf(stream, "      -s SEED         seed of the random walk\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *modes[] = {"flat", "square", "sine", "walk"};
+	const char *report_path = NULL;
+	int opt;
+
+	memset(&workload, 0, sizeof(workload));
+	workload.threads = get_ncpu();
+	workload.mode = FLAT;
+	workload.duty = 1;
+	workload.period = 100;
+	workload.wave = 10000;
+	workload.lifetime = 500;
+	workload.fanout = 1;
+	workload.seed = 1;
+
+	while ((opt = getopt(argc, argv, "t:d:p:m:w:f:l:D:F:T:r:s:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			workload.threads = atoi(optarg);
+			break;
+		case 'd':
+			workload.duty = atof(optarg);
+			break;
+		case 'p':
+			workload.period = atof(optarg);
+			break;
+		case 'm':
+			for (workload.mode = FLAT; workload.mode <= WALK && strcmp(optarg, modes[workload.mode]) != 0; workload.mode++)
+				;
+			break;
+		case 'w':
+			workload.wave = atof(optarg);
+			break;
+		case 'f':
+			workload.fork_rate = atof(optarg);
+			break;
+		case 'l':
+			workload.lifetime = atof(optarg);
+			break;
+		case 'D':
+			workload.depth = atoi(optarg);
+			break;
+		case 'F':
+			workload.fanout = atoi(optarg);
+			break;
+		case 'T':
+			workload.end = now_ms() + atof(optarg) * 1000;
+			break;
+		case 'r':
+			report_path = optarg;
+			break;
+		case 's':
+			workload.seed = (unsigned int)atol(optarg);
+			break;
+		case 'h':
+			print_usage(stdout, argv[0]);
+			return 0;
+		default:
+			print_usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+	/* busy N: N threads always busy */
+	if (optind == argc - 1)
+		workload.threads = atoi(argv[optind]);
+	else if (optind < argc)
+	{
+		print_usage(stderr, argv[0]);
+		return 1;
+	}
+	if (workload.threads < 1 || workload.duty < 0 || workload.duty > 1 || workload.period <= 0 ||
+		workload.mode > WALK || workload.wave <= 0 || workload.lifetime <= 0 ||
+		workload.depth < 0 || workload.fanout < 1)
+	{
+		print_usage(stderr, argv[0]);
+		return 1;
+	}
+	if (report_path != NULL && open_report(report_path) != 0)
+	{
+		fprintf(stderr, "Error: cannot write the report to %s: %s\n", report_path, strerror(errno));
+		return 1;
+	}
+
+	increase_priority();
+	run_node(0);
 	return 0;
 }
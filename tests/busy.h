@@ -0,0 +1,47 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BUSY_H
+#define __BUSY_H
+
+/* demand reported by the workers of busy in a shared file (busy -r FILE)
+every worker owns a slot, the slots are reused round robin */
+#define BUSY_MAGIC 0x62757379
+#define BUSY_SLOTS 4096
+
+struct busy_slot
+{
+	/* pid of the process of the worker, 0 if the slot is free */
+	long pid;
+	/* cpu time the worker wanted, and the one it got (in ms) */
+	double demand;
+	double cputime;
+};
+
+struct busy_report
+{
+	int magic;
+	/* slots taken since the start, modulo BUSY_SLOTS */
+	long next_slot;
+	struct busy_slot slots[BUSY_SLOTS];
+};
+
+#endif
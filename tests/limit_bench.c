@@ -0,0 +1,357 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* accuracy and overhead benchmark of cpulimit
+every workload of busy runs under cpulimit at several limits, the cpu it
+actually gets is compared to the one it wanted (as reported by busy)
+capped by the limit, and the cpu and the wake-ups of cpulimit itself
+are measured */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../src/util.h"
+#include "busy.h"
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+/* the workloads, as options of busy */
+static const struct
+{
+	const char *name;
+	const char *args[8];
+} workloads[] = {
+	/* one process always busy */
+	{"flat", {"-t", "1"}},
+	/* busy 60% of every 250 ms */
+	{"duty", {"-t", "1", "-d", "0.6", "-p", "250"}},
+	/* busy for 1 s every 2 s */
+	{"bursty", {"-t", "1", "-m", "square", "-w", "2000"}},
+	{"sine", {"-t", "1", "-m", "sine", "-w", "4000"}},
+	{"walk", {"-t", "1", "-m", "walk", "-w", "500"}},
+	/* 8 children per second living 500 ms */
+	{"fork", {"-t", "1", "-f", "8", "-l", "500"}},
+	/* a chain of 9 processes */
+	{"deep", {"-t", "1", "-D", "8"}},
+	/* 17 processes */
+	{"many", {"-t", "1", "-D", "1", "-F", "16"}}};
+#define WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+static int ncpu;
+
+static double now_ms(void)
+{
+	struct timespec t;
+	get_time(&t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* run a workload with busy for duration ms */
+static void run_workload(const char *busy, int workload, double duration, const char *report_path)
+{
+	const char *argv[16];
+	char seconds[32];
+	int i, argc = 0;
+	argv[argc++] = busy;
+	for (i = 0; i < 8 && workloads[workload].args[i] != NULL; i++)
+		argv[argc++] = workloads[workload].args[i];
+	sprintf(seconds, "%.3f", duration / 1000);
+	argv[argc++] = "-T";
+	argv[argc++] = seconds;
+	argv[argc++] = "-r";
+	argv[argc++] = report_path;
+	argv[argc] = NULL;
+	execv(busy, (char *const *)argv);
+	perror(busy);
+	exit(1);
+}
+
+/* total cpu time (in ms) wanted by the workers of busy */
+static double read_demand(const char *report_path)
+{
+	struct busy_report *report = (struct busy_report *)malloc(sizeof(struct busy_report));
+	double demand = 0;
+	FILE *fd;
+	int i;
+	if (report == NULL)
+	{
+		exit(-1);
+	}
+	if ((fd = fopen(report_path, "r")) == NULL)
+	{
+		free(report);
+		return -1;
+	}
+	if (fread(report, sizeof(struct busy_report), 1, fd) != 1 || report->magic != BUSY_MAGIC)
+		demand = -1;
+	fclose(fd);
+	for (i = 0; demand >= 0 && i < BUSY_SLOTS; i++)
+	{
+		if (report->slots[i].pid != 0)
+			demand += report->slots[i].demand;
+	}
+	free(report);
+	return demand;
+}
+
+static double rusage_ms(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec * 1e3 + ru->ru_utime.tv_usec / 1e3 +
+		   ru->ru_stime.tv_sec * 1e3 + ru->ru_stime.tv_usec / 1e3;
+}
+
+struct bench_result
+{
+	/* cpu the workload wanted (range 0-NCPU) */
+	double demand;
+	/* cpu used by the workload (range 0-NCPU) */
+	double achieved;
+	/* cpu used by cpulimit (range 0-NCPU) */
+	double overhead;
+	/* voluntary context switches of cpulimit per second */
+	double wakeups;
+};
+
+static int run_bench(const char *cpulimit, const char *busy, int workload, int limit, double duration,
+					 struct bench_result *res)
+{
+	struct rusage workload_usage, limiter_usage;
+	pid_t workload_pid, limiter_pid;
+	char limit_arg[32], pid_arg[32];
+	char report_path[] = "/tmp/cpulimit-bench-XXXXXX";
+	double start, elapsed, demand;
+	int status, fd;
+
+	if ((fd = mkstemp(report_path)) < 0)
+		return -1;
+	close(fd);
+	start = now_ms();
+	if ((workload_pid = fork()) < 0)
+		return -1;
+	if (workload_pid == 0)
+		run_workload(busy, workload, duration, report_path);
+
+	sprintf(limit_arg, "%d", limit);
+	sprintf(pid_arg, "%ld", (long)workload_pid);
+	if ((limiter_pid = fork()) < 0)
+	{
+		kill(workload_pid, SIGKILL);
+		waitpid(workload_pid, NULL, 0);
+		return -1;
+	}
+	if (limiter_pid == 0)
+	{
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			exit(1);
+		/* exit as soon as the workload is over */
+		execl(cpulimit, cpulimit, "-l", limit_arg, "-p", pid_arg, "-i", "-z", (char *)NULL);
+		perror(cpulimit);
+		exit(1);
+	}
+
+	while (wait4(workload_pid, &status, 0, &workload_usage) < 0)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+	elapsed = now_ms() - start;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+	while (wait4(limiter_pid, &status, 0, &limiter_usage) < 0)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+	demand = read_demand(report_path);
+	unlink(report_path);
+	if (demand < 0)
+		return -1;
+
+	res->demand = demand / elapsed;
+	res->achieved = rusage_ms(&workload_usage) / elapsed;
+	res->overhead = rusage_ms(&limiter_usage) / elapsed;
+	res->wakeups = limiter_usage.ru_nvcsw / (elapsed / 1000);
+	return 0;
+}
+
+static void print_usage(FILE *stream, const char *name)
+{
+	fprintf(stream, "Usage: %s [OPTIONS...]\n", name);
+	fprintf(stream, "   OPTIONS\n");
+	fprintf(stream, "      -c CPULIMIT     cpulimit to benchmark (default: ../src/cpulimit next to this program)\n");
+	fprintf(stream, "      -b BUSY         workload generator (default: busy next to this program)\n");
+	fprintf(stream, "      -w WORKLOAD     run only this workload (flat, duty, bursty, sine, walk, fork,\n");
+	fprintf(stream, "                      deep, many), repeatable\n");
+	fprintf(stream, "      -l LIMIT        limit in percentage, repeatable (default: 20, 50, 80)\n");
+	fprintf(stream, "      -d SECONDS      duration of every run (default: 5)\n");
+	fprintf(stream, "      -o FILE         write the report to FILE, in JSON lines\n");
+	fprintf(stream, "      -e ERROR        exit with an error if the achieved cpu of a run is off\n");
+	fprintf(stream, "                      by more than ERROR percentage points\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static char default_cpulimit[PATH_MAX + 1], default_busy[PATH_MAX + 1];
+	static char program_path[PATH_MAX + 1];
+	const char *cpulimit = NULL, *busy = NULL, *report_path = NULL;
+	int limits[16], limit_count = 0;
+	int selected[WORKLOADS];
+	int any_selected = 0, failed = 0;
+	double duration = 5, max_error = -1;
+	FILE *report = NULL;
+	int opt, w, l;
+
+	memset(selected, 0, sizeof(selected));
+	while ((opt = getopt(argc, argv, "c:b:w:l:d:o:e:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			cpulimit = optarg;
+			break;
+		case 'b':
+			busy = optarg;
+			break;
+		case 'w':
+			for (w = 0; w < WORKLOADS && strcmp(optarg, workloads[w].name) != 0; w++)
+				;
+			if (w == WORKLOADS)
+			{
+				fprintf(stderr, "Error: unknown workload %s\n", optarg);
+				return 2;
+			}
+			selected[w] = any_selected = 1;
+			break;
+		case 'l':
+			if (limit_count == (int)(sizeof(limits) / sizeof(limits[0])) || atoi(optarg) <= 0)
+			{
+				fprintf(stderr, "Error: invalid limit %s\n", optarg);
+				return 2;
+			}
+			limits[limit_count++] = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'o':
+			report_path = optarg;
+			break;
+		case 'e':
+			max_error = atof(optarg);
+			break;
+		case 'h':
+			print_usage(stdout, argv[0]);
+			return 0;
+		default:
+			print_usage(stderr, argv[0]);
+			return 2;
+		}
+	}
+	if (duration <= 0 || optind < argc)
+	{
+		print_usage(stderr, argv[0]);
+		return 2;
+	}
+	strncpy(program_path, argv[0], sizeof(program_path) - 1);
+	dirname(program_path);
+	if (cpulimit == NULL)
+	{
+		snprintf(default_cpulimit, sizeof(default_cpulimit), "%s/../src/cpulimit", program_path);
+		cpulimit = default_cpulimit;
+	}
+	if (busy == NULL)
+	{
+		snprintf(default_busy, sizeof(default_busy), "%s/busy", program_path);
+		busy = default_busy;
+	}
+	if (limit_count == 0)
+	{
+		limits[limit_count++] = 20;
+		limits[limit_count++] = 50;
+		limits[limit_count++] = 80;
+	}
+	if (report_path != NULL && (report = fopen(report_path, "w")) == NULL)
+	{
+		fprintf(stderr, "Error: cannot write the report to %s: %s\n", report_path, strerror(errno));
+		return 1;
+	}
+	ncpu = (int)MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+	printf("%-8s %7s %9s %9s %9s %10s %10s\n", "workload", "limit", "expected", "achieved", "error", "overhead", "wake-ups");
+	/* the workloads are forked */
+	fflush(stdout);
+	for (w = 0; w < WORKLOADS; w++)
+	{
+		if (any_selected && !selected[w])
+			continue;
+		for (l = 0; l < limit_count; l++)
+		{
+			struct bench_result res;
+			double expected, error;
+			if (run_bench(cpulimit, busy, w, limits[l], duration * 1000, &res) != 0)
+			{
+				fprintf(stderr, "Error: cannot run %s under %s\n", workloads[w].name, cpulimit);
+				return 1;
+			}
+			expected = MIN(MIN(res.demand, ncpu), limits[l] / 100.0);
+			error = (res.achieved - expected) * 100;
+			printf("%-8s %6d%% %8.1f%% %8.1f%% %+8.1f%% %9.2f%% %8.0f/s\n", workloads[w].name, limits[l],
+				   expected * 100, res.achieved * 100, error, res.overhead * 100, res.wakeups);
+			fflush(stdout);
+			if (report != NULL)
+			{
+				fprintf(report, "{\"workload\":\"%s\",\"limit\":%d,\"ncpu\":%d,\"duration\":%.1f,"
+								"\"demand\":%.2f,\"expected\":%.2f,\"achieved\":%.2f,\"error\":%.2f,"
+								"\"cpulimit_cpu\":%.3f,\"cpulimit_wakeups\":%.1f}\n",
+						workloads[w].name, limits[l], ncpu, duration, res.demand * 100, expected * 100,
+						res.achieved * 100, error, res.overhead * 100, res.wakeups);
+				fflush(report);
+			}
+			if (max_error >= 0 && (error > max_error || error < -max_error))
+				failed = 1;
+		}
+	}
+	if (report != NULL)
+		fclose(report);
+	return failed;
+}
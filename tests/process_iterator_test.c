@@ -27,15 +27,28 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <time.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include "../src/process_iterator.h"
 #include "../src/process_group.h"
+#include "../src/budget.h"
+#include "../src/sampler.h"
+#include "../src/metrics.h"
+#include "../src/histogram.h"
+#include "../src/trace.h"
+#include "../src/exec_watch.h"
+#include "../src/rules.h"
+#include "procfs_fixture.h"
 
 #ifndef __GNUC__
 #define __attribute__(attr)
@@ -87,6 +100,7 @@ static void test_single_process(void)
 	/* don't iterate children */
 	filter.pid = getpid();
 	filter.include_children = 0;
+	filter.comm = NULL;
 	count = 0;
 	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &process) == 0)
@@ -101,6 +115,7 @@ static void test_single_process(void)
 	/* iterate children */
 	filter.pid = getpid();
 	filter.include_children = 0;
+	filter.comm = NULL;
 	count = 0;
 	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &process) == 0)
@@ -130,6 +145,7 @@ static void test_multiple_process(void)
 	}
 	filter.pid = getpid();
 	filter.include_children = 1;
+	filter.comm = NULL;
 	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &process) == 0)
 	{
@@ -155,6 +171,7 @@ static void test_all_processes(void)
 	int count = 0;
 	filter.pid = 0;
 	filter.include_children = 0;
+	filter.comm = NULL;
 	init_process_iterator(&it, &filter);
 
 	while (get_next_process(&it, &process) == 0)
@@ -226,8 +243,694 @@ static void test_process_group_single(int include_children)
 	kill(child, SIGKILL);
 }
 
+static void test_process_group_targets(void)
+{
+	struct process_group pgroup;
+	struct list_node *node;
+	pid_t children[2];
+	int i, count;
+	for (i = 0; i < 2; i++)
+	{
+		children[i] = fork();
+		if (children[i] == 0)
+		{
+			/* child is supposed to be killed by the parent :/ */
+			while (1)
+				sleep(5);
+			exit(1);
+		}
+	}
+	assert(init_process_group(&pgroup, children[0], 0) == 0);
+	assert(pgroup.proclist->count == 1);
+	assert(add_target(&pgroup, children[1]) == 0);
+	assert(add_target(&pgroup, children[1]) == 1);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == 2);
+	assert(remove_target(&pgroup, children[0]) == 0);
+	assert(remove_target(&pgroup, children[0]) == 1);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == 1);
+	node = pgroup.proclist->first;
+	assert(((const struct process *)node->data)->pid == children[1]);
+	/* overlapping subtrees are counted once */
+	pgroup.include_children = 1;
+	assert(add_target(&pgroup, getpid()) == 0);
+	update_process_group(&pgroup);
+	count = 0;
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+	{
+		if (((const struct process *)node->data)->pid == children[1])
+			count++;
+	}
+	assert(count == 1);
+	assert(close_process_group(&pgroup) == 0);
+	for (i = 0; i < 2; i++)
+		kill(children[i], SIGKILL);
+}
+
+static void test_process_group_include_children(void)
+{
+	struct process_group pgroup;
+	struct list_node *node;
+	int fds[2];
+	char c;
+	pid_t child;
+	assert(pipe(fds) == 0);
+	child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		if (fork() > 0)
+			assert(write(fds[1], "x", 1) == 1);
+		/* child is supposed to be killed by the parent :/ */
+		while (1)
+			sleep(5);
+		exit(1);
+	}
+	assert(read(fds[0], &c, 1) == 1);
+	assert(init_process_group(&pgroup, child, 1) == 0);
+	assert(pgroup.proclist->count == 2);
+	/* the change applies at the next update, even a sample */
+	set_include_children(&pgroup, 0);
+	assert(pgroup.targets_changed);
+	sample_process_group(&pgroup);
+	assert(pgroup.proclist->count == 1);
+	assert(locate_process(&pgroup, child) != NULL);
+	set_include_children(&pgroup, 1);
+	sample_process_group(&pgroup);
+	assert(pgroup.proclist->count == 2);
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+		kill(((struct process *)node->data)->pid, SIGKILL);
+	assert(close_process_group(&pgroup) == 0);
+	assert(waitpid(child, NULL, 0) == child);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void test_process_group_reaper(void)
+{
+#if defined(__linux__) && defined(PR_SET_CHILD_SUBREAPER)
+	struct process_group pgroup;
+	pid_t child, orphan = 0;
+	int fds[2];
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0)
+		return;
+	assert(pipe(fds) == 0);
+	child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		orphan = fork();
+		if (orphan == 0)
+		{
+			/* orphan is supposed to be killed by the test */
+			while (1)
+				sleep(5);
+			exit(1);
+		}
+		assert(write(fds[1], &orphan, sizeof(orphan)) == sizeof(orphan));
+		exit(0);
+	}
+	assert(read(fds[0], &orphan, sizeof(orphan)) == sizeof(orphan));
+	assert(waitpid(child, NULL, 0) == child);
+	assert(getppid_of(orphan) == getpid());
+	/* the orphan escaped from the subtree of its parent */
+	assert(init_process_group(&pgroup, child, 1) == 0);
+	assert(pgroup.proclist->count == 0);
+	assert(remove_target(&pgroup, child) == 0);
+	set_target_reaper(&pgroup, getpid());
+	update_process_group(&pgroup);
+	assert(locate_elem(pgroup.proclist, &orphan) != NULL);
+	assert(locate_process(&pgroup, getpid()) == NULL);
+	assert(close_process_group(&pgroup) == 0);
+	kill(orphan, SIGKILL);
+	assert(waitpid(orphan, NULL, 0) == orphan);
+	prctl(PR_SET_CHILD_SUBREAPER, 0, 0, 0, 0);
+	close(fds[0]);
+	close(fds[1]);
+#endif
+}
+
+static void test_process_group_children_time(void)
+{
+#if defined(__linux__)
+	struct process_group pgroup;
+	struct timespec interval;
+	double accounted = 0, used;
+	int fds[2], seen = 0;
+	pid_t child;
+	assert(pipe(fds) == 0);
+	child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		struct rusage usage;
+		pid_t grandchild = fork();
+		if (grandchild == 0)
+		{
+			/* a member for a while, then waited for by its parent */
+			while (clock() < CLOCKS_PER_SEC / 2)
+				;
+			exit(0);
+		}
+		assert(waitpid(grandchild, NULL, 0) == grandchild);
+		assert(getrusage(RUSAGE_CHILDREN, &usage) == 0);
+		used = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 +
+			   usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+		assert(write(fds[1], &used, sizeof(used)) == sizeof(used));
+		/* child is supposed to be killed by the parent :/ */
+		while (1)
+			sleep(5);
+		exit(1);
+	}
+	close(fds[1]);
+	assert(init_process_group(&pgroup, child, 1) == 0);
+	interval.tv_sec = 0;
+	interval.tv_nsec = 50000000;
+	while (1)
+	{
+		struct timeval timeout = {0, 0};
+		fd_set set;
+		FD_ZERO(&set);
+		FD_SET(fds[0], &set);
+		if (select(fds[0] + 1, &set, NULL, NULL, &timeout) == 1)
+			break;
+		sleep_timespec(&interval);
+		update_process_group(&pgroup);
+		accounted += pgroup.sample_cputime;
+		seen = MAX(seen, pgroup.proclist->count);
+	}
+	assert(read(fds[0], &used, sizeof(used)) == sizeof(used));
+	sleep_timespec(&interval);
+	update_process_group(&pgroup);
+	accounted += pgroup.sample_cputime;
+	/* the cpu time of the grandchild is accounted once */
+	assert(seen == 2);
+	assert(accounted > used - 50 && accounted < used + 50);
+	assert(close_process_group(&pgroup) == 0);
+	kill(child, SIGKILL);
+	assert(waitpid(child, NULL, 0) == child);
+	close(fds[0]);
+#endif
+}
+
+static void count_captured(void *data, struct process *p)
+{
+	(void)p;
+	(*(int *)data)++;
+}
+
+static void test_process_group_capture(void)
+{
+	struct process_group pgroup;
+	struct list parents;
+	struct list_node *node;
+	int start[2], ready[2], captured = 0;
+	pid_t child;
+	char c;
+	assert(pipe(start) == 0 && pipe(ready) == 0);
+	child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		setpgid(0, 0);
+		/* wait to be a member before forking */
+		assert(read(start[0], &c, 1) == 1);
+		if (fork() == 0 && fork() == 0)
+			assert(write(ready[1], "x", 1) == 1);
+		/* child is supposed to be killed by the parent :/ */
+		while (1)
+			sleep(5);
+		exit(1);
+	}
+	setpgid(child, child);
+	assert(init_process_group(&pgroup, child, 1) == 0);
+	assert(pgroup.proclist->count == 1);
+	assert(write(start[1], "x", 1) == 1);
+	/* the grandchild and its child */
+	assert(read(ready[0], &c, 1) == 1);
+	init_list(&parents, sizeof(pid_t));
+	add_elem(&parents, locate_process(&pgroup, child));
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 2);
+	assert(captured == 2 && parents.count == 3 && pgroup.proclist->count == 3);
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 0);
+	clear_list(&parents);
+	/* the pgid of the child was not shared, it is checked again */
+	assert(pgroup.pgids_stale);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == 3);
+	/* the members captured share the process group of the child */
+	assert(is_whole_pgid(&pgroup, child));
+	assert(!pgroup.pgids_stale);
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+		kill(((struct process *)node->data)->pid, SIGKILL);
+	assert(close_process_group(&pgroup) == 0);
+	assert(waitpid(child, NULL, 0) == child);
+	close(start[0]);
+	close(start[1]);
+	close(ready[0]);
+	close(ready[1]);
+}
+
+static void test_process_group_sample(void)
+{
+	struct process_group pgroup;
+	struct timespec interval;
+	struct rlimit files, limited;
+	pid_t children[2];
+	int fd[64], fds, i;
+	for (i = 0; i < 2; i++)
+	{
+		children[i] = fork();
+		assert(children[i] >= 0);
+		if (children[i] == 0)
+		{
+			/* child is supposed to be killed by the parent :/ */
+			volatile int unused_value = 0;
+			while (1)
+				(void)unused_value;
+			exit(1);
+		}
+	}
+	assert(init_process_group(&pgroup, children[0], 0) == 0);
+	interval.tv_sec = 0;
+	interval.tv_nsec = 100000000;
+	sleep_timespec(&interval);
+	/* the members are sampled, not searched */
+	assert(sample_process_group(&pgroup) == 0);
+	assert(pgroup.proclist->count == 1 && pgroup.sample_interval > 0);
+	assert(locate_process(&pgroup, children[0])->cpu_usage >= 0);
+	/* a new target is searched */
+	assert(add_target(&pgroup, children[1]) == 0);
+	sleep_timespec(&interval);
+	assert(sample_process_group(&pgroup) == 1);
+	assert(pgroup.proclist->count == 2);
+	/* the members stay while no descriptor is left to read them */
+	assert(getrlimit(RLIMIT_NOFILE, &files) == 0);
+	limited = files;
+	limited.rlim_cur = 64;
+	assert(setrlimit(RLIMIT_NOFILE, &limited) == 0);
+	for (fds = 0; fds < 64 && (fd[fds] = dup(0)) >= 0; fds++)
+		;
+	sleep_timespec(&interval);
+	assert(sample_process_group(&pgroup) == 0);
+	assert(pgroup.proclist->count == 2);
+	while (fds > 0)
+		close(fd[--fds]);
+	assert(setrlimit(RLIMIT_NOFILE, &files) == 0);
+	/* a member gone leaves the group */
+	kill(children[0], SIGKILL);
+	assert(waitpid(children[0], NULL, 0) == children[0]);
+	sleep_timespec(&interval);
+	assert(sample_process_group(&pgroup) == 1);
+	assert(pgroup.proclist->count == 1);
+	assert(locate_elem(pgroup.proclist, &children[1]) != NULL);
+	assert(close_process_group(&pgroup) == 0);
+	kill(children[1], SIGKILL);
+	assert(waitpid(children[1], NULL, 0) == children[1]);
+}
+
+static void test_process_group_rejoin(void)
+{
+	struct process_group pgroup;
+	struct timespec interval;
+	struct process *p;
+	pid_t child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		/* child is supposed to be killed by the parent :/ */
+		volatile int unused_value = 0;
+		while (1)
+			(void)unused_value;
+		exit(1);
+	}
+	assert(init_process_group(&pgroup, child, 0) == 0);
+	assert(remove_target(&pgroup, child) == 0);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == 0);
+	interval.tv_sec = 1;
+	interval.tv_nsec = 0;
+	sleep_timespec(&interval);
+	/* the cpu time used outside of the group is not accounted */
+	assert(add_target(&pgroup, child) == 0);
+	update_process_group(&pgroup);
+	p = locate_process(&pgroup, child);
+	assert(pgroup.proclist->count == 1 && p->cpu_usage < 0);
+	assert(pgroup.sample_cputime < 1);
+	interval.tv_sec = 0;
+	interval.tv_nsec = 100000000;
+	sleep_timespec(&interval);
+	update_process_group(&pgroup);
+	assert(p->cpu_usage >= 0 && p->cpu_usage <= 1.05);
+	assert(close_process_group(&pgroup) == 0);
+	kill(child, SIGKILL);
+	assert(waitpid(child, NULL, 0) == child);
+}
+
+static void test_process_group_pgids(void)
+{
+	struct process_group pgroup;
+	struct list_node *node;
+	struct timespec interval;
+	int fds[2], leave[2];
+	char c;
+	pid_t child, grandchild = 0;
+	assert(pipe(fds) == 0 && pipe(leave) == 0);
+	child = fork();
+	if (child == 0)
+	{
+		/* a process group made of the child and the grandchild */
+		setpgid(0, 0);
+		if (fork() > 0)
+			assert(write(fds[1], "x", 1) == 1);
+		else if (read(leave[0], &c, 1) == 1)
+		{
+			/* the grandchild leaves for a process group of its own */
+			setpgid(0, 0);
+			assert(write(fds[1], "x", 1) == 1);
+		}
+		/* child is supposed to be killed by the parent :/ */
+		while (1)
+			sleep(5);
+		exit(1);
+	}
+	setpgid(child, child);
+	assert(read(fds[0], &c, 1) == 1);
+	assert(init_process_group(&pgroup, child, 1) == 0);
+	assert(pgroup.proclist->count == 2);
+	for (node = pgroup.proclist->first; node != NULL; node = node->next)
+	{
+		const struct process *p = (const struct process *)node->data;
+		assert(p->pgid == child);
+		if (p->pid != child)
+			grandchild = p->pid;
+	}
+	assert(is_whole_pgid(&pgroup, child));
+	assert(!is_whole_pgid(&pgroup, getpgrp()));
+	/* a sample notices the move, the old group is not signalled any more */
+	assert(write(leave[1], "x", 1) == 1);
+	assert(read(fds[0], &c, 1) == 1);
+	interval.tv_sec = 0;
+	interval.tv_nsec = 50000000;
+	sleep_timespec(&interval);
+	sample_process_group(&pgroup);
+	assert(locate_process(&pgroup, grandchild)->pgid == grandchild);
+	assert(!is_whole_pgid(&pgroup, child));
+	assert(close_process_group(&pgroup) == 0);
+	close(fds[0]);
+	close(fds[1]);
+	close(leave[0]);
+	close(leave[1]);
+	/* without the children the grandchild is left out */
+	assert(init_process_group(&pgroup, child, 0) == 0);
+	assert(!is_whole_pgid(&pgroup, child));
+	assert(close_process_group(&pgroup) == 0);
+	kill(-child, SIGKILL);
+	kill(grandchild, SIGKILL);
+}
+
+static void test_budget_tree(void)
+{
+	struct process_group pgroup;
+	struct budget_tree tree;
+	struct budget_node *root, *group;
+	pid_t children[2];
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		children[i] = fork();
+		if (children[i] == 0)
+		{
+			/* child is supposed to be killed by the parent :/ */
+			while (1)
+				sleep(5);
+			exit(1);
+		}
+	}
+	assert(init_process_group(&pgroup, children[0], 0) == 0);
+	assert(add_target(&pgroup, children[1]) == 0);
+	update_process_group(&pgroup);
+	assert(init_budget_tree(&tree, 0.6) == 0);
+	assert(add_budget_node(&tree, children[1], 0.2) == 0);
+	assert(add_budget_node(&tree, children[1], 0.2) == 1);
+	root = budget_root(&tree);
+	group = (struct budget_node *)tree.nodes->last->data;
+	assert(group->pid == children[1] && group->parent == root);
+
+	/* both busy: the nested group gets its limit, the rest the remainder */
+	locate_process(&pgroup, children[0])->cpu_usage = 0.5;
+	locate_process(&pgroup, children[1])->cpu_usage = 0.5;
+	update_budget_tree(&tree, &pgroup);
+	assert(root->members->count == 1 && group->members->count == 1);
+	assert(group->share > 0.199 && group->share < 0.201);
+	assert(root->share > 0.399 && root->share < 0.401);
+	assert(!under_budget_limits(&tree, 0.9));
+
+	/* the share of an idle group goes to its siblings */
+	locate_process(&pgroup, children[1])->cpu_usage = 0;
+	update_budget_tree(&tree, &pgroup);
+	assert(root->share > 0.599 && root->share < 0.601);
+
+	/* once running at full speed, both demand less than their limit */
+	locate_process(&pgroup, children[0])->cpu_usage = 0.1;
+	for (i = 0; i < 5; i++)
+		update_budget_tree(&tree, &pgroup);
+	assert(root->demand > 0.099 && root->demand < 0.101);
+	assert(under_budget_limits(&tree, 0.9));
+	assert(!under_budget_limits(&tree, 0.1));
+
+	assert(remove_budget_node(&tree, children[1]) == 0);
+	assert(remove_budget_node(&tree, children[1]) == 1);
+	update_budget_tree(&tree, &pgroup);
+	assert(tree.nodes->count == 1 && root->members->count == 2);
+
+	assert(close_budget_tree(&tree) == 0);
+	assert(close_process_group(&pgroup) == 0);
+	for (i = 0; i < 2; i++)
+		kill(children[i], SIGKILL);
+}
+
 char *command = NULL;
 
+static void test_stat_sampler(void)
+{
+	struct sigaction action;
+	struct itimerval timer;
+	struct stat_sampler sampler;
+	struct process_iterator it;
+	struct process process;
+	struct process_filter filter;
+	struct process *procs[2];
+	double cputimes[2] = {-1, -1};
+	volatile long i;
+	if (init_stat_sampler(&sampler) != 0)
+	{
+		/* io_uring is not available */
+		assert(sample_cputimes(&sampler, procs, 0, cputimes, NULL, NULL) == -1);
+		close_stat_sampler(&sampler);
+		return;
+	}
+	filter.pid = getpid();
+	filter.include_children = 0;
+	filter.comm = NULL;
+	init_process_iterator(&it, &filter);
+	assert(get_next_process(&it, &process) == 0);
+	assert(close_process_iterator(&it) == 0);
+	procs[0] = procs[1] = &process;
+	for (i = 0; i < 100000000; i++)
+		;
+	assert(sample_cputimes(&sampler, procs, 1, cputimes, NULL, NULL) == 0);
+	assert(cputimes[0] > process.cputime && cputimes[1] == -1);
+	/* the descriptor is kept open */
+	process.cputime = cputimes[0];
+	assert(sample_cputimes(&sampler, procs, 1, cputimes, NULL, NULL) == 0);
+	assert(cputimes[0] >= process.cputime);
+	/* the reads complete even if signals interrupt the wait */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = ignore_signal;
+	sigaction(SIGALRM, &action, NULL);
+	timer.it_value.tv_sec = timer.it_interval.tv_sec = 0;
+	timer.it_value.tv_usec = timer.it_interval.tv_usec = 50;
+	setitimer(ITIMER_REAL, &timer, NULL);
+	for (i = 0; i < 1000; i++)
+	{
+		process.cputime = cputimes[0];
+		assert(sample_cputimes(&sampler, procs, 1, cputimes, NULL, NULL) == 0);
+		assert(cputimes[0] >= process.cputime);
+	}
+	timer.it_value.tv_usec = timer.it_interval.tv_usec = 0;
+	setitimer(ITIMER_REAL, &timer, NULL);
+	signal(SIGALRM, SIG_DFL);
+	close_stat_sampler(&sampler);
+}
+
+static void test_metrics(void)
+{
+	struct metrics metrics;
+	struct process_group pgroup;
+	char path[] = "/tmp/cpulimit_test_XXXXXX";
+	char spec[64], line[1024];
+	FILE *fd;
+	int tmp_fd = mkstemp(path);
+	assert(tmp_fd >= 0);
+	close(tmp_fd);
+	assert(open_metrics(&metrics, "xml:/tmp/x", 1) != 0);
+	assert(open_metrics(&metrics, "json:", 1) != 0);
+	assert(init_process_group(&pgroup, getpid(), 0) == 0);
+
+	/* a json line every 2 cycles */
+	sprintf(spec, "json:%s", path);
+	assert(open_metrics(&metrics, spec, 2) == 0);
+	metrics.signals = 3;
+	record_metrics(&metrics, &pgroup, 0.5, 0.25, 0.5);
+	record_metrics(&metrics, &pgroup, 0.5, 0.25, 0.5);
+	close_metrics(&metrics);
+	assert((fd = fopen(path, "r")) != NULL);
+	assert(fgets(line, sizeof(line), fd) != NULL);
+	assert(strstr(line, "\"signals\":3,\"members_added\":1,\"members_removed\":0,") != NULL);
+	assert(fgets(line, sizeof(line), fd) == NULL);
+	fclose(fd);
+
+	/* the textfile is replaced, then removed at the end */
+	sprintf(spec, "prometheus:%s", path);
+	assert(open_metrics(&metrics, spec, 1) == 0);
+	record_metrics(&metrics, &pgroup, 0.5, 0.25, 0.5);
+	assert((fd = fopen(path, "r")) != NULL);
+	assert(fgets(line, sizeof(line), fd) != NULL);
+	assert(strncmp(line, "# HELP cpulimit_", 16) == 0);
+	fclose(fd);
+	close_metrics(&metrics);
+	assert(access(path, F_OK) != 0);
+	assert(close_process_group(&pgroup) == 0);
+}
+
+static void test_trace(void)
+{
+	struct trace trace;
+	struct trace_header header;
+	struct trace_cycle cycle;
+	struct process_group pgroup;
+	char path[] = "/tmp/cpulimit_test_XXXXXX";
+	int i, tmp_fd = mkstemp(path);
+	assert(tmp_fd >= 0);
+	close(tmp_fd);
+	assert(init_process_group(&pgroup, getpid(), 0) == 0);
+
+	header.limit = 0.5;
+	header.ncpu = 4;
+	header.time_slot = 100000;
+	header.flags = TRACE_NESTED_GROUPS;
+	assert(open_trace_writer(&trace, path, &header) == 0);
+	/* not inherited by the command */
+	assert(fcntl(fileno(trace.file), F_GETFD) & FD_CLOEXEC);
+	memset(&cycle, 0, sizeof(cycle));
+	for (i = 0; i < 3; i++)
+	{
+		cycle.limit = 0.5;
+		cycle.pcpu = 0.1 * i;
+		cycle.workingrate = 0.25;
+		cycle.twork = 25000;
+		cycle.tsleep = 75000;
+		write_trace_cycle(&trace, &pgroup, &cycle);
+	}
+	close_trace(&trace);
+
+	memset(&header, 0, sizeof(header));
+	assert(open_trace_reader(&trace, path, &header) == 0);
+	assert(header.limit == 0.5 && header.ncpu == 4 && header.time_slot == 100000);
+	assert(header.flags == TRACE_NESTED_GROUPS);
+	for (i = 0; i < 3; i++)
+	{
+		assert(read_trace_cycle(&trace, &cycle) == 1);
+		assert(cycle.pcpu == 0.1 * i && cycle.workingrate == 0.25 && cycle.tsleep == 75000);
+		assert(cycle.count == 1 && cycle.members[0].pid == getpid());
+		assert(cycle.members[0].ppid == getppid());
+		/* never sampled */
+		assert(cycle.members[0].used == -1);
+	}
+	assert(read_trace_cycle(&trace, &cycle) == 0);
+	close_trace(&trace);
+	free(cycle.members);
+
+	/* not a trace */
+	assert(open_trace_reader(&trace, "/dev/null", &header) != 0);
+	unlink(path);
+	assert(close_process_group(&pgroup) == 0);
+}
+
+static void test_rules(void)
+{
+	struct rule_set rules;
+	const struct rule *rule;
+	struct process_iterator it;
+	struct process process;
+	struct process_filter filter;
+	char path[] = "/tmp/cpulimit_test_XXXXXX";
+	FILE *fd;
+	int tmp_fd = mkstemp(path);
+	assert(tmp_fd >= 0 && (fd = fdopen(tmp_fd, "w")) != NULL);
+	fprintf(fd, "# comment\n\ncomm=nothing limit=10\n");
+	fprintf(fd, "uid=%ld limit=30\n", (long)getuid() + 1);
+	fprintf(fd, "uid=%ld cmdline=\"process_iterator_test$\" limit=50 include-children\n", (long)getuid());
+	fclose(fd);
+	assert(load_rules(&rules, path, 1) == 0);
+	assert(rules.count == 3 && !rules_changed(&rules));
+
+	filter.pid = getpid();
+	filter.include_children = 0;
+	filter.comm = NULL;
+	init_process_iterator(&it, &filter);
+	assert(get_next_process(&it, &process) == 0);
+	close_process_iterator(&it);
+	rule = match_rules(&rules, &process);
+	assert(rule != NULL && rule->line == 5 && rule->include_children);
+	assert(rule->limit > 0.499 && rule->limit < 0.501);
+
+	/* a broken file keeps the old rules */
+	assert((fd = fopen(path, "w")) != NULL);
+	fprintf(fd, "comm=nothing\n");
+	fclose(fd);
+	assert(rules_changed(&rules) == 1);
+	assert(reload_rules(&rules, 1) != 0 && rules.count == 3);
+	assert((fd = fopen(path, "w")) != NULL);
+	fprintf(fd, "exe=%s limit=20\n", basename(command));
+	fclose(fd);
+	assert(reload_rules(&rules, 1) == 0 && rules.count == 1);
+	assert(match_rules(&rules, &process) == &rules.rules[0]);
+	free_rules(&rules);
+	remove(path);
+}
+
+static void test_histogram(void)
+{
+	struct histogram h;
+	int i;
+	init_histogram(&h, "test", "us", 1);
+	assert(value_at_percentile(&h, 50) == 0);
+	for (i = 1; i <= 100000; i++)
+		record_value(&h, i);
+	assert(h.count == 100000 && h.min == 1 && h.max == 100000);
+	/* within the precision of the buckets */
+	assert(value_at_percentile(&h, 50) > 48500 && value_at_percentile(&h, 50) < 51500);
+	assert(value_at_percentile(&h, 99) > 96000 && value_at_percentile(&h, 99) <= 100000);
+	assert(value_at_percentile(&h, 100) == 100000);
+	/* negative values come first */
+	init_histogram(&h, "test", "%", 100);
+	for (i = -100; i < 100; i++)
+		record_value(&h, i / 100.0);
+	assert(value_at_percentile(&h, 0) == -1);
+	assert(value_at_percentile(&h, 25) > -0.52 && value_at_percentile(&h, 25) < -0.49);
+	assert(value_at_percentile(&h, 75) > 0.48 && value_at_percentile(&h, 75) < 0.51);
+	/* the largest magnitudes, and beyond */
+	init_histogram(&h, "test", "us", 1);
+	for (i = 0; i < 10; i++)
+		record_value(&h, 3e10);
+	record_value(&h, 1e300);
+	assert(value_at_percentile(&h, 50) > 2.9e10 && value_at_percentile(&h, 50) < 3.1e10);
+	assert(value_at_percentile(&h, 100) == 1e300);
+}
+
 static void test_process_name(void)
 {
 	struct process_iterator it;
@@ -238,6 +941,7 @@ static void test_process_name(void)
 	int cmp_len;
 	filter.pid = getpid();
 	filter.include_children = 0;
+	filter.comm = NULL;
 	init_process_iterator(&it, &filter);
 	assert(get_next_process(&it, &process) == 0);
 	assert(process.pid == getpid());
@@ -252,6 +956,41 @@ static void test_process_name(void)
 	close_process_iterator(&it);
 }
 
+static void test_process_renamed(void)
+{
+#ifdef __linux__
+	int ready[2];
+	char byte;
+	pid_t child;
+	/* a short name decides alone, a name as long as the kernel allows may
+	be truncated: the command line decides */
+	const char *names[] = {"renamed", "renamed-process"};
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		assert(pipe(ready) == 0);
+		child = fork();
+		assert(child >= 0);
+		if (child == 0)
+		{
+			/* the name (comm) of the process is not its command any more */
+			prctl(PR_SET_NAME, names[i], 0, 0, 0);
+			assert(write(ready[1], "", 1) == 1);
+			while (1)
+				pause();
+		}
+		assert(read(ready[0], &byte, 1) == 1);
+		assert(may_be_named(child, basename(command)) == i);
+		assert(may_be_named(child, names[i]) == 1);
+		assert(may_be_named(child, "nothing") == 0);
+		kill(child, SIGKILL);
+		assert(waitpid(child, NULL, 0) == child);
+		close(ready[0]);
+		close(ready[1]);
+	}
+#endif
+}
+
 static void test_process_group_wrong_pid(void)
 {
 	struct process_group pgroup;
@@ -271,6 +1010,206 @@ static void test_find_process_by_pid(void)
 	assert(find_process_by_pid(getpid()) == getpid());
 }
 
+static void test_sharded_scan(void)
+{
+	struct process_iterator it;
+	struct process process;
+	struct process_filter filter;
+	pid_t pids[4096];
+	int count = 0, i = 0;
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	set_scan_workers(1);
+	init_process_iterator(&it, &filter);
+	while (get_next_process(&it, &process) == 0 && count < 4096)
+		pids[count++] = process.pid;
+	close_process_iterator(&it);
+	/* the same processes, in the same order */
+	set_scan_workers(4);
+	init_process_iterator(&it, &filter);
+	while (get_next_process(&it, &process) == 0)
+	{
+		assert(i < count && process.pid == pids[i]);
+		if (process.pid == getpid())
+			assert(process.ppid == getppid());
+		i++;
+	}
+	close_process_iterator(&it);
+	assert(i == count);
+	assert(find_process_by_name(command) == getpid());
+	set_scan_workers(0);
+}
+
+/* count the processes of a fixture in the subtree of pid */
+static int count_subtree(const struct procfs_fixture *f, pid_t pid)
+{
+	pid_t p;
+	int count = 0;
+	for (p = 1; p <= f->last_pid; p++)
+	{
+		pid_t ancestor;
+		if (!f->alive[p])
+			continue;
+		for (ancestor = p; ancestor > 0 && ancestor != pid; ancestor = f->ppids[ancestor])
+			;
+		if (ancestor == pid)
+			count++;
+	}
+	return count;
+}
+
+static void test_procfs_fixture(void)
+{
+	struct procfs_fixture f;
+	struct process_iterator it;
+	struct process process;
+	struct process_filter filter;
+	struct process_group pgroup;
+	struct list parents;
+	char path[PATH_MAX + 64];
+	char name[] = "worker5";
+	struct list children;
+	pid_t pid, grandchild;
+	int count = 0, captured = 0;
+	assert(create_fixture(&f, 300, 8) == 0);
+	if (set_procfs_root(f.root) != 0)
+	{
+		/* no procfs on this system */
+		destroy_fixture(&f);
+		return;
+	}
+	filter.pid = 0;
+	filter.include_children = 0;
+	filter.comm = NULL;
+	init_process_iterator(&it, &filter);
+	while (get_next_process(&it, &process) == 0)
+	{
+		assert(process.ppid == f.ppids[process.pid]);
+		count++;
+	}
+	close_process_iterator(&it);
+	assert(count == 300);
+	init_list(&children, sizeof(pid_t));
+	/* the middle of the first chain */
+	init_process_group(&pgroup, 4, 1);
+	assert(pgroup.proclist->count == count_subtree(&f, 4));
+	/* the children forked by a stopped member, found in the children files */
+	init_list(&parents, sizeof(pid_t));
+	add_elem(&parents, locate_process(&pgroup, 4));
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 0);
+	pid = spawn_fake_process(&f, 4);
+	assert((grandchild = spawn_fake_process(&f, pid)) > 0);
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 2);
+	assert(captured == 2 && pgroup.proclist->count == count_subtree(&f, 4));
+	/* all the processes are scanned if the kernel does not list the children */
+	sprintf(path, "%s/4/task/4/children", f.root);
+	assert(unlink(path) == 0);
+	assert(get_process_children(4, &children) == -1);
+	assert(get_process_children(f.max_pid + 1, &children) == 1);
+	assert(children.count == 0);
+	assert(spawn_fake_process(&f, pid) > 0);
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 1);
+	assert(pgroup.proclist->count == count_subtree(&f, 4));
+	clear_list(&parents);
+	/* only the children not listed are scanned for, after the others */
+	sprintf(path, "%s/%ld/task/%ld/children", f.root, (long)pid, (long)pid);
+	assert(unlink(path) == 0);
+	add_elem(&parents, locate_process(&pgroup, grandchild));
+	add_elem(&parents, locate_process(&pgroup, pid));
+	assert(spawn_fake_process(&f, grandchild) > 0);
+	assert(spawn_fake_process(&f, pid) > 0);
+	assert(capture_children(&pgroup, &parents, count_captured, &captured) == 2);
+	assert(parents.count == 4 && pgroup.proclist->count == count_subtree(&f, 4));
+	clear_list(&parents);
+	churn_fixture(&f, 30);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == count_subtree(&f, 4));
+	/* overlapping subtrees, their members are counted once */
+	assert(add_target(&pgroup, 1) == 0);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == count_subtree(&f, 1));
+	assert(remove_target(&pgroup, 1) == 0);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == count_subtree(&f, 4));
+	close_process_group(&pgroup);
+	pid = find_process_by_name(name);
+	assert(pid > 0 && f.alive[pid] && pid % FIXTURE_COMMANDS == 5);
+	set_procfs_root("/proc");
+	destroy_fixture(&f);
+	assert(find_process_by_name(command) == getpid());
+}
+
+/* count the live processes of a fixture running the command of pid */
+static int count_instances(const struct procfs_fixture *f, pid_t pid)
+{
+	pid_t p;
+	int count = 0;
+	for (p = 1; p <= f->last_pid; p++)
+	{
+		if (f->alive[p] && p % FIXTURE_COMMANDS == pid % FIXTURE_COMMANDS)
+			count++;
+	}
+	return count;
+}
+
+static void test_process_group_name(void)
+{
+	struct procfs_fixture f;
+	struct process_group pgroup;
+	pid_t pid;
+	assert(create_fixture(&f, 300, 8) == 0);
+	if (set_procfs_root(f.root) != 0)
+	{
+		destroy_fixture(&f);
+		return;
+	}
+	pid = find_process_by_name("worker5");
+	assert(pid > 0);
+	init_process_group(&pgroup, pid, 0);
+	remove_target(&pgroup, pid);
+	set_target_name(&pgroup, "/usr/bin/worker5");
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == count_instances(&f, pid));
+	/* instances come and go */
+	churn_fixture(&f, 30);
+	update_process_group(&pgroup);
+	assert(pgroup.proclist->count == count_instances(&f, pid));
+	close_process_group(&pgroup);
+	set_procfs_root("/proc");
+	destroy_fixture(&f);
+}
+
+static void test_exec_watch(void)
+{
+	struct exec_watch watch;
+	struct timespec timeout = {5, 0};
+	pid_t child;
+	int i, seen = 0;
+	if (open_exec_watch(&watch, "true") != 0)
+	{
+		/* executions cannot be watched on this system */
+		return;
+	}
+	assert(watch.type != EXEC_WATCH_NONE);
+	child = fork();
+	assert(child >= 0);
+	if (child == 0)
+	{
+		execlp("true", "true", (char *)NULL);
+		exit(1);
+	}
+	assert(wait_exec_event(&watch, &timeout) == 1);
+	assert(waitpid(child, NULL, 0) == child);
+	/* the process is told, unless the events cannot tell it */
+	for (i = 0; i < watch.count; i++)
+		seen |= watch.pids[i] == child;
+	assert(seen || watch.lost);
+	clear_exec_events(&watch);
+	assert(watch.count == 0 && !watch.lost);
+	close_exec_watch(&watch);
+}
+
 static void test_find_process_by_name(void)
 {
 	assert(find_process_by_name(command) == getpid());
@@ -284,6 +1223,7 @@ static void test_getppid_of(void)
 	struct process_filter filter;
 	filter.pid = 0;
 	filter.include_children = 0;
+	filter.comm = NULL;
 	init_process_iterator(&it, &filter);
 	while (get_next_process(&it, &process) == 0)
 	{
@@ -308,12 +1248,31 @@ int main(int argc __attribute__((unused)), char *argv[])
 	test_single_process();
 	test_multiple_process();
 	test_all_processes();
+	test_sharded_scan();
+	test_procfs_fixture();
+	test_process_group_name();
 	test_process_group_all();
 	test_process_group_single(0);
 	test_process_group_single(1);
 	test_process_group_wrong_pid();
+	test_process_group_targets();
+	test_process_group_include_children();
+	test_process_group_reaper();
+	test_process_group_children_time();
+	test_process_group_capture();
+	test_process_group_sample();
+	test_process_group_rejoin();
+	test_process_group_pgids();
+	test_budget_tree();
+	test_stat_sampler();
+	test_metrics();
+	test_trace();
+	test_rules();
+	test_histogram();
 	test_process_name();
+	test_process_renamed();
 	test_find_process_by_pid();
+	test_exec_watch();
 	test_find_process_by_name();
 	test_getppid_of();
 	return 0;
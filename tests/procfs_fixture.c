@@ -0,0 +1,265 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "procfs_fixture.h"
+
+/* deterministic pseudo-random numbers, the same fixture every run */
+static unsigned long next_random(struct procfs_fixture *f)
+{
+	f->seed = f->seed * 1103515245UL + 12345UL;
+	return (f->seed >> 16) & 0x7fff;
+}
+
+static int write_file(const char *path, const char *content, size_t len)
+{
+	FILE *fd;
+	int ret = 0;
+	if ((fd = fopen(path, "w")) == NULL)
+		return -1;
+	if (fwrite(content, 1, len, fd) != len)
+		ret = -1;
+	if (fclose(fd) != 0)
+		ret = -1;
+	return ret;
+}
+
+static int write_stat(struct procfs_fixture *f, pid_t pid)
+{
+	char path[PATH_MAX + 32], content[256];
+	int len;
+	sprintf(path, "%s/%ld/stat", f->root, (long)pid);
+	/* the processes are their own process group leaders, and have used
+	some cpu time depending on their pid */
+	len = sprintf(content, "%ld (worker%d) S %ld %ld %ld 0 -1 4194304 100 0 0 0 %ld %ld 0 0 20 0 1 0 %ld 1000000 100\n",
+				  (long)pid, (int)(pid % FIXTURE_COMMANDS), (long)f->ppids[pid], (long)pid, (long)pid,
+				  (long)(pid % 1000), (long)(pid % 100), (long)pid);
+	return write_file(path, content, len);
+}
+
+/* the children of a process, as listed by the kernel in the children
+file of its main thread
+append: the pid of a single new child, 0 to list them all again */
+static int write_children(struct procfs_fixture *f, pid_t pid, pid_t append)
+{
+	char path[PATH_MAX + 96];
+	FILE *fd;
+	pid_t child;
+	int ret = 0;
+	sprintf(path, "%s/%ld/task/%ld/children", f->root, (long)pid, (long)pid);
+	if ((fd = fopen(path, append > 0 ? "a" : "w")) == NULL)
+		return -1;
+	for (child = append > 0 ? append : pid + 1; child <= f->last_pid; child++)
+	{
+		if (f->alive[child] && f->ppids[child] == pid && fprintf(fd, "%ld ", (long)child) < 0)
+			ret = -1;
+		if (append > 0)
+			break;
+	}
+	if (fclose(fd) != 0)
+		ret = -1;
+	return ret;
+}
+
+/* the last pid created is read from loadavg */
+static int write_loadavg(struct procfs_fixture *f)
+{
+	char path[PATH_MAX + 32], content[64];
+	int len;
+	sprintf(path, "%s/loadavg", f->root);
+	len = sprintf(content, "0.00 0.00 0.00 1/%d %ld\n", f->count, (long)f->last_pid);
+	return write_file(path, content, len);
+}
+
+/* add a process, its pid is the next free one
+return:  the pid of the new process, -1 on error */
+pid_t spawn_fake_process(struct procfs_fixture *f, pid_t ppid)
+{
+	char path[PATH_MAX + 32], cmdline[64], comm[32];
+	pid_t pid;
+	int len;
+	if (f->last_pid >= f->max_pid)
+		return -1;
+	pid = ++f->last_pid;
+	f->ppids[pid] = ppid;
+	sprintf(path, "%s/%ld", f->root, (long)pid);
+	if (mkdir(path, 0755) != 0)
+		return -1;
+	f->alive[pid] = 1;
+	/* the arguments are separated by NUL characters */
+	len = sprintf(cmdline, "/usr/bin/worker%d", (int)(pid % FIXTURE_COMMANDS)) + 1;
+	len += sprintf(cmdline + len, "--id=%ld", (long)pid) + 1;
+	sprintf(path, "%s/%ld/cmdline", f->root, (long)pid);
+	if (write_file(path, cmdline, len) != 0 || write_stat(f, pid) != 0)
+		return -1;
+	len = sprintf(comm, "worker%d\n", (int)(pid % FIXTURE_COMMANDS));
+	sprintf(path, "%s/%ld/comm", f->root, (long)pid);
+	if (write_file(path, comm, len) != 0)
+		return -1;
+	sprintf(path, "%s/%ld/task", f->root, (long)pid);
+	if (mkdir(path, 0755) != 0)
+		return -1;
+	sprintf(path, "%s/%ld/task/%ld", f->root, (long)pid, (long)pid);
+	if (mkdir(path, 0755) != 0 || write_children(f, pid, 0) != 0)
+		return -1;
+	if (ppid > 0 && f->alive[ppid] && write_children(f, ppid, pid) != 0)
+		return -1;
+	f->count++;
+	return write_loadavg(f) == 0 ? pid : -1;
+}
+
+static int remove_files(struct procfs_fixture *f, pid_t pid)
+{
+	char path[PATH_MAX + 96];
+	f->alive[pid] = 0;
+	f->count--;
+	sprintf(path, "%s/%ld/stat", f->root, (long)pid);
+	unlink(path);
+	sprintf(path, "%s/%ld/cmdline", f->root, (long)pid);
+	unlink(path);
+	sprintf(path, "%s/%ld/comm", f->root, (long)pid);
+	unlink(path);
+	sprintf(path, "%s/%ld/task/%ld/children", f->root, (long)pid, (long)pid);
+	unlink(path);
+	sprintf(path, "%s/%ld/task/%ld", f->root, (long)pid, (long)pid);
+	rmdir(path);
+	sprintf(path, "%s/%ld/task", f->root, (long)pid);
+	rmdir(path);
+	sprintf(path, "%s/%ld", f->root, (long)pid);
+	return rmdir(path);
+}
+
+/* remove a process, its children are adopted by init
+return:  0 on success, -1 on error */
+int kill_fake_process(struct procfs_fixture *f, pid_t pid)
+{
+	pid_t child;
+	if (pid <= 1 || pid > f->last_pid || !f->alive[pid])
+		return -1;
+	for (child = pid + 1; child <= f->last_pid; child++)
+	{
+		if (!f->alive[child] || f->ppids[child] != pid)
+			continue;
+		f->ppids[child] = 1;
+		if (write_stat(f, child) != 0 || write_children(f, 1, child) != 0)
+			return -1;
+	}
+	if (remove_files(f, pid) != 0)
+		return -1;
+	return f->ppids[pid] > 0 && f->alive[f->ppids[pid]] ? write_children(f, f->ppids[pid], 0) : 0;
+}
+
+static pid_t random_process(struct procfs_fixture *f)
+{
+	pid_t pid;
+	do
+	{
+		pid = 1 + (pid_t)((next_random(f) << 15 | next_random(f)) % f->last_pid);
+	} while (!f->alive[pid]);
+	return pid;
+}
+
+/* build a fixture of count processes in a new temporary directory
+return:  0 on success, -1 on error */
+int create_fixture(struct procfs_fixture *f, int count, int depth)
+{
+	pid_t ppid = 0;
+	int i;
+	const char *tmpdir = getenv("TMPDIR");
+	struct stat st;
+	/* in memory if possible, the fixtures have up to hundreds of thousands of files */
+	if (tmpdir == NULL)
+		tmpdir = stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? "/dev/shm" : "/tmp";
+	if (strlen(tmpdir) + 32 > sizeof(f->root))
+		return -1;
+	sprintf(f->root, "%s/cpulimit-procfs-XXXXXX", tmpdir);
+	if (mkdtemp(f->root) == NULL)
+		return -1;
+	f->count = 0;
+	f->last_pid = 0;
+	f->depth = depth;
+	f->seed = 1;
+	/* room for the churn */
+	f->max_pid = 4 * count + 1024;
+	f->ppids = (pid_t *)calloc(f->max_pid + 1, sizeof(pid_t));
+	f->alive = (char *)calloc(f->max_pid + 1, sizeof(char));
+	if (f->ppids == NULL || f->alive == NULL)
+	{
+		exit(-1);
+	}
+	for (i = 0; i < count; i++)
+	{
+		pid_t pid;
+		/* the chains start from random processes, init for the first one */
+		if (i % depth == 0)
+			ppid = i == 0 ? 0 : random_process(f);
+		if ((pid = spawn_fake_process(f, ppid)) < 0)
+		{
+			destroy_fixture(f);
+			return -1;
+		}
+		ppid = pid;
+	}
+	return 0;
+}
+
+/* n processes die and n new ones are born */
+void churn_fixture(struct procfs_fixture *f, int n)
+{
+	int i;
+	for (i = 0; i < n && f->count > 1; i++)
+	{
+		pid_t pid;
+		while ((pid = random_process(f)) == 1)
+			;
+		kill_fake_process(f, pid);
+	}
+	for (i = 0; i < n; i++)
+		spawn_fake_process(f, random_process(f));
+}
+
+void destroy_fixture(struct procfs_fixture *f)
+{
+	char path[PATH_MAX + 32];
+	pid_t pid;
+	for (pid = 1; pid <= f->last_pid; pid++)
+	{
+		if (f->alive[pid])
+			remove_files(f, pid);
+	}
+	sprintf(path, "%s/loadavg", f->root);
+	unlink(path);
+	rmdir(f->root);
+	free(f->ppids);
+	free(f->alive);
+	f->ppids = NULL;
+	f->alive = NULL;
+}
@@ -0,0 +1,59 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __PROCFS_FIXTURE_H
+#define __PROCFS_FIXTURE_H
+
+#include <limits.h>
+#include <sys/types.h>
+
+/* number of different commands of the fake processes */
+#define FIXTURE_COMMANDS 16
+
+/* fake procfs tree, to be read through set_procfs_root()
+pid 1 is init, the other processes form chains of depth processes
+hanging from random processes created before them */
+struct procfs_fixture
+{
+	char root[PATH_MAX + 1];
+	/* ppid of every pid */
+	pid_t *ppids;
+	/* 1 if the pid exists */
+	char *alive;
+	/* the pids are never reused */
+	pid_t last_pid;
+	pid_t max_pid;
+	int count;
+	int depth;
+	unsigned long seed;
+};
+
+int create_fixture(struct procfs_fixture *f, int count, int depth);
+
+pid_t spawn_fake_process(struct procfs_fixture *f, pid_t ppid);
+
+int kill_fake_process(struct procfs_fixture *f, pid_t pid);
+
+void churn_fixture(struct procfs_fixture *f, int n);
+
+void destroy_fixture(struct procfs_fixture *f);
+
+#endif
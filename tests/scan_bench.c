@@ -0,0 +1,104 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* benchmark of the scans of /proc on fake procfs trees
+usage: scan_bench [COUNT...] (default: 1000 10000 100000 processes) */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/process_iterator.h"
+#include "../src/process_group.h"
+#include "../src/util.h"
+#include "procfs_fixture.h"
+
+/* length of the chains of processes */
+#define DEPTH 64
+/* updates of the process group measured for each fixture */
+#define ROUNDS 10
+
+static void run_bench(int count)
+{
+	struct procfs_fixture f;
+	struct process_group pgroup;
+	struct timespec start, end;
+	double create_time, update_time = 0, find_time;
+	char name[] = "worker7";
+	pid_t target, found;
+	int i, members = 0;
+
+	get_time(&start);
+	if (create_fixture(&f, count, DEPTH) != 0)
+	{
+		perror("create_fixture");
+		exit(1);
+	}
+	get_time(&end);
+	create_time = timediff_in_ms(&end, &start);
+	set_procfs_root(f.root);
+
+	/* the middle of the first chain, its descendants have deep ancestries */
+	target = DEPTH / 2;
+	init_process_group(&pgroup, target, 1);
+	for (i = 0; i < ROUNDS; i++)
+	{
+		/* 1% of the processes are replaced between two updates */
+		churn_fixture(&f, count / 100);
+		get_time(&start);
+		update_process_group(&pgroup);
+		get_time(&end);
+		update_time += timediff_in_ms(&end, &start);
+		members += pgroup.proclist->count;
+	}
+	close_process_group(&pgroup);
+
+	get_time(&start);
+	found = find_process_by_name(name);
+	get_time(&end);
+	find_time = timediff_in_ms(&end, &start);
+
+	printf("%7d processes: fixture %8.1f ms, update_process_group %8.2f ms (%d members), find_process_by_name %8.2f ms (pid %ld)\n",
+		   count, create_time, update_time / ROUNDS, members / ROUNDS, find_time, (long)found);
+	fflush(stdout);
+	set_procfs_root("/proc");
+	destroy_fixture(&f);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	if (argc > 1)
+	{
+		for (i = 1; i < argc; i++)
+			run_bench(atoi(argv[i]));
+	}
+	else
+	{
+		run_bench(1000);
+		run_bench(10000);
+		run_bench(100000);
+	}
+	return 0;
+}
@@ -0,0 +1,459 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* deterministic simulator of the control loop
+the processes are replaced by a plant model following scripted demand
+curves, and the system clock by a simulated one: thousands of seconds
+of control run in a few milliseconds, always with the same results */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/process_group.h"
+#include "../src/budget.h"
+#include "../src/controller.h"
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#define MAX_PROCS 16
+/* step of the integration of the plant (in ms) */
+#define PLANT_STEP 1.0
+/* resolution of the cpu times read from the system (in ms, USER_HZ=100) */
+#define CPUTIME_TICK 10.0
+/* timers never expire before the next multiple of this (in ms) */
+#define TIMER_TICK 0.05
+/* length of the windows in which the tracking is measured (in ms) */
+#define WINDOW 1000.0
+/* the error is settled when it stays within this fraction of the limit */
+#define SETTLING_BAND 0.05
+/* shortest simulation (in s), several periods of the demand curves */
+#define MIN_SECONDS 60
+
+/* requirements of the control, measured after the first window (spent
+learning the working rate): rms of the tracking error and largest usage
+above the limit (range 0-NCPU), time to settle after the last change (in s) */
+#define MAX_RMS 0.02
+#define MAX_OVERSHOOT 0.05
+#define MAX_SETTLING 2.0
+
+/* demand curve of a process: before until step_at (fraction of the
+simulation), after since then, and if period>0 (in ms) only during the
+first fraction duty of every period */
+struct demand_curve
+{
+	double before;
+	double after;
+	double step_at;
+	double period;
+	double duty;
+};
+
+struct scenario
+{
+	const char *name;
+	int ncpu;
+	/* limit of the whole group */
+	double limit;
+	/* the last nested processes get a nested group each, limited to sub_limit */
+	double sub_limit;
+	int nested;
+	/* seconds of limit saved for bursts, 0 if none */
+	double burst;
+	/* work-conserving mode: limit while there is no cpu pressure, 0 if
+	disabled, and when the pressure starts and ends (fractions of the
+	simulation) */
+	double hard_limit;
+	double pressure_from;
+	double pressure_until;
+	int count;
+	struct demand_curve demand[MAX_PROCS];
+	/* 1 if the demand stops changing, the settling time is checked */
+	int settles;
+	/* fewest slots run freely (fraction of all the slots) */
+	double min_free;
+	/* known exceedance of MAX_OVERSHOOT, the overshoot allowed instead
+	and why (0 and NULL if none) */
+	double known_overshoot;
+	const char *known;
+};
+
+/* the samples see a step of the demand one slot late, meanwhile the
+processes run at the speed of the last slot: the usage of the window of
+the step exceeds the limit by (usage after the step - limit) * TIME_SLOT/WINDOW */
+#define STEP_EXCEEDANCE "one slot of the step at full speed"
+
+static const struct scenario scenarios[] = {
+	{"single", 1, 0.3, 0, 0, 0, 0, 0, 0, 1, {{1, 1, 0, 0, 0}}, 1, 0, 0, NULL},
+	{"many", 4, 2, 0, 0, 0, 0, 0, 0, 8, {{1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}}, 1, 0, 0, NULL},
+	/* idle half of the time, runs freely then */
+	{"duty", 1, 0.5, 0, 0, 0, 0, 0, 0, 1, {{1, 1, 0, 10000, 0.5}}, 0, 0.4, 0.055, STEP_EXCEEDANCE},
+	{"step", 2, 0.5, 0, 0, 0, 0, 0, 0, 1, {{0.2, 1, 0.1, 0, 0}}, 1, 0.05, 0.055, STEP_EXCEEDANCE},
+	{"nested", 2, 1, 0.2, 1, 0, 0, 0, 0, 2, {{1, 1, 0, 0, 0}, {1, 1, 0, 0, 0}}, 1, 0, 0, NULL},
+	/* nested siblings stepping up at once, their parent must not overshoot */
+	{"siblings", 2, 1, 0.8, 2, 0, 0, 0, 0, 2, {{0.1, 1, 0.1, 0, 0}, {0.1, 1, 0.1, 0, 0}}, 1, 0.05, 0.105, STEP_EXCEEDANCE},
+	/* idle half of the time, the credit saved is spent at full speed */
+	{"burst", 1, 0.3, 0, 0, 2, 0, 0, 0, 1, {{1, 1, 0, 10000, 0.5}}, 0, 0.4, 0, NULL},
+	/* under the limit, then above it */
+	{"free", 1, 0.5, 0, 0, 0, 0, 0, 0, 1, {{0.2, 1, 0.5, 0, 0}}, 1, 0.45, 0.055, STEP_EXCEEDANCE},
+	/* the limit is enforced during the pressure only */
+	{"pressure", 2, 0.3, 0, 0, 0, 1, 0.3, 0.6, 1, {{1, 1, 0, 0, 0}}, 1, 0, 0, NULL}};
+
+struct sim_process
+{
+	pid_t pid;
+	/* the curve of the scenario, step_at in ms */
+	struct demand_curve demand;
+	/* cpu time actually used (in ms) */
+	double cputime;
+	int stopped;
+	/* in a nested group of its own */
+	int nested;
+	/* cputime at the start of the window (in ms) */
+	double window_cputime;
+};
+
+struct simulation
+{
+	const struct scenario *scenario;
+	/* simulated time and length of the simulation (in ms) */
+	double now;
+	double duration;
+	struct sim_process procs[MAX_PROCS];
+	struct process_group pgroup;
+	struct budget_tree budget;
+	struct limiter_modes modes;
+	/* limit of the whole group chosen by the modes for the current slot */
+	double limit;
+	/* demand of the whole group bounded by the limit and the cpus, and
+	the limit, integrated over the current window (in ms) */
+	double target;
+	double limit_sum;
+};
+
+static double demand_at(const struct demand_curve *d, double t)
+{
+	if (d->period > 0 && fmod(t, d->period) >= d->duty * d->period)
+		return 0;
+	return t < d->step_at ? d->before : d->after;
+}
+
+/* let the processes run until time end
+when they want more than the cpus, the cpus are shared fairly */
+static void advance(struct simulation *sim, double end)
+{
+	const struct scenario *sc = sim->scenario;
+	while (sim->now < end)
+	{
+		double step = MIN(PLANT_STEP, end - sim->now);
+		double total = 0, unlimited = 0, scale;
+		int i;
+		for (i = 0; i < sc->count; i++)
+		{
+			double d = demand_at(&sim->procs[i].demand, sim->now);
+			unlimited += d;
+			if (!sim->procs[i].stopped)
+				total += d;
+		}
+		scale = total > sc->ncpu ? sc->ncpu / total : 1;
+		for (i = 0; i < sc->count; i++)
+		{
+			if (!sim->procs[i].stopped)
+				sim->procs[i].cputime += demand_at(&sim->procs[i].demand, sim->now) * scale * step;
+		}
+		sim->target += MIN(MIN(unlimited, sc->ncpu), sim->limit) * step;
+		sim->limit_sum += sim->limit * step;
+		sim->now += step;
+	}
+}
+
+static double timespec_to_ms(const struct timespec *t)
+{
+	return t->tv_sec * 1e3 + t->tv_nsec / 1e6;
+}
+
+static void sim_now(void *data, struct timespec *t)
+{
+	struct simulation *sim = (struct simulation *)data;
+	t->tv_sec = (time_t)(sim->now / 1000);
+	t->tv_nsec = (long)((sim->now - t->tv_sec * 1000.0) * 1e6);
+}
+
+static void sim_sleep_until(void *data, const struct timespec *start, double offset_nsec)
+{
+	struct simulation *sim = (struct simulation *)data;
+	double end = timespec_to_ms(start) + offset_nsec / 1e6;
+	advance(sim, ceil(end / TIMER_TICK) * TIMER_TICK);
+}
+
+static struct sim_process *find_sim_process(struct simulation *sim, pid_t pid)
+{
+	int i;
+	for (i = 0; i < sim->scenario->count; i++)
+	{
+		if (sim->procs[i].pid == pid)
+			return &sim->procs[i];
+	}
+	return NULL;
+}
+
+static void sim_resume(void *data)
+{
+	struct simulation *sim = (struct simulation *)data;
+	int i;
+	for (i = 0; i < sim->scenario->count; i++)
+		sim->procs[i].stopped = 0;
+}
+
+static void sim_stop(void *data, struct budget_node *group)
+{
+	struct simulation *sim = (struct simulation *)data;
+	struct list_node *node;
+	for (node = group->members->first; node != NULL; node = node->next)
+	{
+		struct sim_process *p = find_sim_process(sim, ((struct process *)node->data)->pid);
+		if (p != NULL)
+			p->stopped = 1;
+	}
+}
+
+/* the cpus are contended by other processes during the pressure only */
+static int sim_pressure(void *data, double own)
+{
+	struct simulation *sim = (struct simulation *)data;
+	(void)own;
+	return sim->now >= sim->scenario->pressure_from * sim->duration &&
+		   sim->now < sim->scenario->pressure_until * sim->duration;
+}
+
+static void init_simulation(struct simulation *sim, const struct scenario *sc, double seconds)
+{
+	int i;
+	memset(sim, 0, sizeof(struct simulation));
+	sim->scenario = sc;
+	sim->duration = seconds * 1000;
+	/* an empty group, the simulated processes are added by hand */
+	init_process_group(&sim->pgroup, -1, 0);
+	remove_target(&sim->pgroup, -1);
+	init_budget_tree(&sim->budget, sc->limit);
+	init_limiter_modes(&sim->modes, sc->burst, sc->hard_limit > 0 ? sc->hard_limit : -1);
+	sim->limit = sc->limit;
+	for (i = 0; i < sc->count; i++)
+	{
+		struct process proc;
+		struct sim_process *p = &sim->procs[i];
+		memset(&proc, 0, sizeof(struct process));
+		p->pid = proc.pid = 1000 + i;
+		proc.ppid = 1;
+		p->demand = sc->demand[i];
+		p->demand.step_at *= sim->duration;
+		p->nested = i >= sc->count - sc->nested;
+		add_process(&sim->pgroup, &proc);
+		if (p->nested)
+			add_budget_node(&sim->budget, p->pid, sc->sub_limit);
+	}
+}
+
+static void close_simulation(struct simulation *sim)
+{
+	close_budget_tree(&sim->budget);
+	close_process_group(&sim->pgroup);
+}
+
+/* sample the cpu times as the system would report them */
+static void sample(struct simulation *sim, double *last_sample)
+{
+	struct list_node *node;
+	double dt = sim->now - *last_sample;
+	sim->pgroup.sample_cputime = 0;
+	sim->pgroup.sample_interval = 0;
+	if (dt < MIN_DT)
+		return;
+	for (node = sim->pgroup.proclist->first; node != NULL; node = node->next)
+	{
+		struct process *p = (struct process *)node->data;
+		struct sim_process *s = find_sim_process(sim, p->pid);
+		update_cpu_usage(&sim->pgroup, p, floor(s->cputime / CPUTIME_TICK) * CPUTIME_TICK, dt);
+	}
+	sim->pgroup.sample_interval = dt;
+	*last_sample = sim->now;
+}
+
+struct sim_result
+{
+	/* root mean square of the tracking error of the group (range 0-NCPU) */
+	double rms;
+	/* largest usage above the limit of the group or of a nested group */
+	double overshoot;
+	/* time (in s) after the last change of demand before the error
+	stays within the band, -1 if it never does */
+	double settling;
+	/* fraction of the slots run freely */
+	double free;
+};
+
+static void run_scenario(const struct scenario *sc, double seconds, struct sim_result *res)
+{
+	struct limiter_clock clock;
+	struct limiter_actuator actuator;
+	struct limiter_pressure pressure;
+	struct simulation sim;
+	double last_sample = 0, window_start = 0;
+	double last_total = 0;
+	double error_sum = 0;
+	double settled_since = 0;
+	int windows = 0, slots = 0, free_slots = 0;
+
+	init_simulation(&sim, sc, seconds);
+	clock.data = actuator.data = pressure.data = &sim;
+	clock.now = sim_now;
+	clock.sleep_until = sim_sleep_until;
+	actuator.resume = sim_resume;
+	actuator.stop = sim_stop;
+	pressure.enforce = sim_pressure;
+	res->overshoot = 0;
+
+	while (sim.now < seconds * 1000)
+	{
+		int free_run = sim.modes.free_run;
+		sample(&sim, &last_sample);
+		sim.limit = update_limiter_modes(&sim.modes, sc->limit, sc->ncpu, &sim.pgroup, &pressure);
+		budget_root(&sim.budget)->limit = sim.limit;
+		update_budget_tree(&sim.budget, &sim.pgroup);
+		slots++;
+		if (update_free_run(&sim.modes, &sim.budget, &sim.pgroup))
+		{
+			struct timespec start;
+			if (!free_run)
+				sim_resume(&sim);
+			sim_now(&sim, &start);
+			sim_sleep_until(&sim, &start, TIME_SLOT * 1000.0);
+			free_slots++;
+		}
+		else
+			run_control_slot(&sim.budget, &clock, &actuator);
+
+		if (sim.now - window_start >= WINDOW)
+		{
+			double total = 0, usage, error;
+			double length = sim.now - window_start;
+			int i;
+			for (i = 0; i < sc->count; i++)
+				total += sim.procs[i].cputime;
+			usage = (total - last_total) / length;
+			error = usage - sim.target / length;
+			/* the first window is spent learning the working rate */
+			if (windows > 0)
+			{
+				error_sum += error * error;
+				res->overshoot = MAX(res->overshoot, usage - sim.limit_sum / length);
+				for (i = 0; i < sc->count; i++)
+				{
+					struct sim_process *p = &sim.procs[i];
+					if (p->nested)
+						res->overshoot = MAX(res->overshoot, (p->cputime - p->window_cputime) / length - sc->sub_limit);
+				}
+			}
+			windows++;
+			if (fabs(error) > SETTLING_BAND * sc->limit)
+				settled_since = sim.now;
+			last_total = total;
+			for (i = 0; i < sc->count; i++)
+				sim.procs[i].window_cputime = sim.procs[i].cputime;
+			sim.target = 0;
+			sim.limit_sum = 0;
+			window_start = sim.now;
+		}
+	}
+	res->rms = windows > 1 ? sqrt(error_sum / (windows - 1)) : 0;
+	res->free = slots > 0 ? (double)free_slots / slots : 0;
+	/* the demand changes for the last time at the step, the limit at the
+	end of the pressure */
+	res->settling = settled_since >= sim.duration - WINDOW ? -1 : MAX(settled_since - MAX(sim.procs[0].demand.step_at, sc->pressure_until * sim.duration), 0) / 1000;
+	close_simulation(&sim);
+}
+
+int main(int argc, char *argv[])
+{
+	double seconds = 1000;
+	const char *name = NULL;
+	int count = sizeof(scenarios) / sizeof(scenarios[0]);
+	int i, failed = 0, found = 0;
+
+	if (argc > 1)
+		seconds = atof(argv[1]);
+	if (argc > 2)
+		name = argv[2];
+	if (argc > 3 || seconds < MIN_SECONDS)
+	{
+		fprintf(stderr, "Usage: %s [SECONDS [SCENARIO]], at least %d seconds\n", argv[0], MIN_SECONDS);
+		return 2;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (name == NULL || strcmp(name, scenarios[i].name) == 0)
+			found = 1;
+	}
+	if (!found)
+	{
+		fprintf(stderr, "Unknown scenario: %s\n", name);
+		return 2;
+	}
+
+	printf("%-8s %8s %10s %10s %10s %10s  %s\n", "scenario", "limit", "rms error", "overshoot", "settling", "free run", "result");
+	for (i = 0; i < count; i++)
+	{
+		const struct scenario *sc = &scenarios[i];
+		struct sim_result res;
+		double max_overshoot;
+		int ok;
+		if (name != NULL && strcmp(name, sc->name) != 0)
+			continue;
+		run_scenario(sc, seconds, &res);
+		max_overshoot = sc->known != NULL ? sc->known_overshoot : MAX_OVERSHOOT;
+		ok = res.rms <= MAX_RMS && res.overshoot <= max_overshoot &&
+			 (!sc->settles || (res.settling >= 0 && res.settling <= MAX_SETTLING)) &&
+			 res.free >= sc->min_free;
+		printf("%-8s %7.0f%% %9.2f%% %9.2f%% ", sc->name, sc->limit * 100, res.rms * 100, res.overshoot * 100);
+		if (sc->settles && res.settling >= 0)
+			printf("%8.1f s", res.settling);
+		else
+			printf("%10s", "-");
+		printf(" %9.2f%%  %s", res.free * 100, ok ? "ok" : "FAILED");
+		if (sc->known != NULL)
+			printf(" (known: %s)", sc->known);
+		printf("\n");
+		failed |= !ok;
+	}
+	return failed;
+}
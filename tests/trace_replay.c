@@ -0,0 +1,185 @@
+/**
+ *
+ * cpulimit - a CPU limiter for Linux
+ *
+ * Copyright (C) 2005-2012, by:  Angelo Marletta <angelo dot marletta at gmail dot com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* replay of a trace recorded with cpulimit --trace=FILE
+the recorded samples are fed to the estimator and the budget tree of this
+build, and its decisions are compared to the recorded ones
+the traces of nested groups are refused, their budget tree is not recorded
+usage: trace_replay [-v] FILE */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "../src/process_group.h"
+#include "../src/budget.h"
+#include "../src/trace.h"
+#include "../src/list.h"
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+struct replay_stats
+{
+	int cycles;
+	double duration;
+	/* sums over the cycles */
+	double recorded_pcpu;
+	double limit;
+	double pcpu_diff;
+	double workingrate_diff;
+	double max_workingrate_diff;
+};
+
+/* make the members of the group the ones of the cycle, and sample their
+cpu time when cpulimit did
+the cpu time accounted is the recorded one, the debts of the children
+were paid already */
+static void replay_members(struct process_group *pgroup, const struct trace_cycle *cycle)
+{
+	struct list previous = *pgroup->proclist;
+	int i;
+	init_list(pgroup->proclist, sizeof(pid_t));
+	for (i = 0; i < cycle->count; i++)
+	{
+		const struct trace_member *m = &cycle->members[i];
+		struct process *p = locate_process(pgroup, m->pid);
+		if (p == NULL)
+		{
+			struct process proc;
+			memset(&proc, 0, sizeof(struct process));
+			proc.pid = m->pid;
+			proc.ppid = m->ppid;
+			proc.cputime = m->cputime;
+			p = add_process(pgroup, &proc);
+		}
+		else
+		{
+			add_elem(pgroup->proclist, p);
+			/* it left the group and came back, it starts over */
+			if (locate_elem(&previous, &m->pid) == NULL)
+				p->cpu_usage = -1;
+		}
+		p->ppid = m->ppid;
+		if (cycle->interval > 0 && m->used >= 0)
+			update_cpu_usage(pgroup, p, p->cputime + m->used, cycle->interval);
+		p->cputime = m->cputime;
+	}
+	clear_list(&previous);
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace trace;
+	struct trace_header header;
+	struct trace_cycle cycle;
+	struct process_group pgroup;
+	struct budget_tree budget;
+	struct replay_stats stats;
+	const char *path = argc > 1 ? argv[argc - 1] : NULL;
+	int verbose = argc == 3 && strcmp(argv[1], "-v") == 0;
+	int ret;
+
+	if (path == NULL || argc > 3 || (argc == 3 && !verbose))
+	{
+		fprintf(stderr, "Usage: %s [-v] FILE\n", argv[0]);
+		return 2;
+	}
+	if (open_trace_reader(&trace, path, &header) != 0)
+	{
+		fprintf(stderr, "Error: cannot read the trace %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (header.flags & TRACE_NESTED_GROUPS)
+	{
+		fprintf(stderr, "Error: the trace %s has nested groups, it cannot be replayed exactly\n", path);
+		close_trace(&trace);
+		return 1;
+	}
+
+	/* an empty group, the members come from the trace */
+	init_process_group(&pgroup, -1, 0);
+	remove_target(&pgroup, -1);
+	init_budget_tree(&budget, header.limit);
+	memset(&stats, 0, sizeof(stats));
+	memset(&cycle, 0, sizeof(cycle));
+
+	if (verbose)
+		printf("%10s %8s %10s %10s %10s %10s\n", "time", "limit", "pcpu", "replayed", "workrate", "replayed");
+	while ((ret = read_trace_cycle(&trace, &cycle)) == 1)
+	{
+		struct list_node *node;
+		double pcpu = -1, diff;
+		replay_members(&pgroup, &cycle);
+		for (node = pgroup.proclist->first; node != NULL; node = node->next)
+		{
+			const struct process *p = (const struct process *)node->data;
+			if (p->cpu_usage < 0)
+				continue;
+			pcpu = MAX(pcpu, 0) + p->cpu_usage;
+		}
+		budget_root(&budget)->limit = cycle.limit;
+		update_budget_tree(&budget, &pgroup);
+		if (pcpu < 0)
+			pcpu = cycle.limit;
+
+		diff = fabs(MAX(budget_root(&budget)->workingrate, 0) - cycle.workingrate);
+		stats.cycles++;
+		stats.duration = cycle.time;
+		stats.recorded_pcpu += cycle.pcpu;
+		stats.limit += cycle.limit;
+		stats.pcpu_diff += fabs(pcpu - cycle.pcpu);
+		stats.workingrate_diff += diff;
+		if (diff > stats.max_workingrate_diff)
+			stats.max_workingrate_diff = diff;
+		if (verbose)
+			printf("%9.3fs %7.2f%% %9.2f%% %9.2f%% %9.2f%% %9.2f%%\n", cycle.time, cycle.limit * 100,
+				   cycle.pcpu * 100, pcpu * 100, cycle.workingrate * 100,
+				   MAX(budget_root(&budget)->workingrate, 0) * 100);
+	}
+	free(cycle.members);
+	close_trace(&trace);
+	close_budget_tree(&budget);
+	close_process_group(&pgroup);
+	if (ret < 0)
+	{
+		fprintf(stderr, "Error: the trace %s is truncated or corrupted\n", path);
+		return 1;
+	}
+
+	printf("Cycles: %d in %.1f s (%d cpu, time slot %d us)\n", stats.cycles, stats.duration,
+		   header.ncpu, header.time_slot);
+	if (stats.cycles == 0)
+		return 0;
+	printf("Recorded cpu usage: %.2f%% (limit %.2f%%)\n", stats.recorded_pcpu / stats.cycles * 100,
+		   stats.limit / stats.cycles * 100);
+	printf("Estimated cpu usage: %.2f%% off on average\n", stats.pcpu_diff / stats.cycles * 100);
+	printf("Working rate: %.2f%% off on average, %.2f%% at most\n",
+		   stats.workingrate_diff / stats.cycles * 100, stats.max_workingrate_diff * 100);
+	return 0;
+}